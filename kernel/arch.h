@@ -1,4 +1,5 @@
 #pragma once
+#include <libs/common/list.h>
 #include <libs/common/types.h>
 
 struct cpuvar;
@@ -9,13 +10,32 @@ struct cpuvar;
 
 struct task;
 
+// ランキュー。優先度ごとに実行可能なタスクのキューを持つ。
+struct runqueue {
+    uint32_t bitmap;                     // 空でない (可能性がある) キューのビットマップ
+    list_t queues[NUM_TASK_PRIORITIES];  // 各優先度の実行可能なタスクのキュー
+};
+
+#define PAGE_CACHE_SIZE  32  // CPUごとにキャッシュする空きページの最大数
+#define PAGE_CACHE_BATCH 16  // 一度に補充・返却する空きページの数
+
+// CPUごとの空きページのキャッシュ。1ページの割り当て・解放はここで済ませ、バディアロケータ
+// へはまとめて補充・返却する。
+struct page_cache {
+    unsigned count;                  // キャッシュしているページの数
+    paddr_t pages[PAGE_CACHE_SIZE];  // 空きページの物理アドレス (末尾ほど最近解放)
+};
+
 struct cpuvar {
     struct arch_cpuvar arch;
     int id;
     bool online;
+    bool idle;  // 実行するタスクがなく、割り込みが来るまで眠っている
     unsigned ipi_pending;
     struct task *idle_task;
     struct task *current_task;
+    struct runqueue runqueue;
+    struct page_cache page_cache;
     unsigned magic;
 };
 
@@ -49,17 +69,29 @@ error_t arch_vm_init(struct arch_vm *vm);
 void arch_vm_destroy(struct arch_vm *vm);
 error_t arch_vm_map(struct arch_vm *vm, vaddr_t vaddr, paddr_t paddr,
                     unsigned attrs);
-error_t arch_vm_unmap(struct arch_vm *vm, vaddr_t vaddr);
+error_t arch_vm_unmap(struct arch_vm *vm, vaddr_t vaddr, paddr_t *paddr);
+error_t arch_vm_lookup(struct arch_vm *vm, vaddr_t vaddr, paddr_t *paddr);
+error_t arch_vm_move(struct arch_vm *src, vaddr_t src_vaddr,
+                     struct arch_vm *dst, vaddr_t dst_vaddr, paddr_t *paddr,
+                     paddr_t *replaced);
 vaddr_t arch_paddr_to_vaddr(paddr_t paddr);
 bool arch_is_mappable_uaddr(uaddr_t uaddr);
-error_t arch_task_init(struct task *task, uaddr_t ip, vaddr_t kernel_entry,
-                       void *arg);
+error_t arch_task_init(struct task *task, uaddr_t ip, uaddr_t sp,
+                       vaddr_t kernel_entry, void *arg);
 void arch_task_destroy(struct task *task);
 void arch_task_switch(struct task *prev, struct task *next);
 void arch_init(void);
 void arch_init_percpu(void);
 void arch_idle(void);
+unsigned arch_uptime_ticks(void);
+uint32_t arch_read_cycles(void);
+void arch_set_timer(unsigned ticks);
+struct cpuvar *arch_cpuvar_of(int id);
+void arch_lock(void);
+void arch_unlock(void);
 void arch_send_ipi(unsigned ipi);
+void arch_send_ipi_to(int id, unsigned ipi);
+void arch_handle_tlb_flush(void);
 void arch_memcpy_from_user(void *dst, __user const void *src, size_t len);
 void arch_memcpy_to_user(__user void *dst, const void *src, size_t len);
 error_t arch_irq_enable(unsigned irq);
@@ -214,7 +214,7 @@ __noreturn void hinavm_run(struct hinavm *hinavm) {
                 }
 
                 error_t err = ipc(dst, 0, (__user struct message *) &current->m,
-                                  IPC_SEND | IPC_KERNEL);
+                                  IPC_SEND | IPC_KERNEL, 0);
                 regs[inst.ipc.a] = err;
                 break;
             }
@@ -228,14 +228,14 @@ __noreturn void hinavm_run(struct hinavm *hinavm) {
                 }
 
                 error_t err = ipc(dst, 0, (__user struct message *) &current->m,
-                                  IPC_SEND | IPC_NOBLOCK | IPC_KERNEL);
+                                  IPC_SEND | IPC_NOBLOCK | IPC_KERNEL, 0);
                 regs[inst.ipc.a] = err;
                 break;
             }
             case HINAVM_RECV: {
                 task_t src = regs[inst.ipc.b];
                 error_t err = ipc(0, src, (__user struct message *) &current->m,
-                                  IPC_RECV | IPC_KERNEL);
+                                  IPC_RECV | IPC_KERNEL, 0);
                 regs[inst.ipc.a] = err;
                 break;
             }
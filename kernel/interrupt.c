@@ -6,8 +6,129 @@
 
 // 割り込み通知を受け付けるタスクの一覧。
 static struct task *irq_listeners[IRQ_MAX];
-// 起動してからの経過時間。単位はタイマー割り込みの周期 (TICK_HZ) に依存する。
-unsigned uptime_ticks = 0;
+// 設定中のタイマーの二分ヒープ。タイムアウトする時刻が最も早いタイマーが先頭 (timers[0])
+// にあり、各タイマーはその子 (timers[index * 2 + 1] と timers[index * 2 + 2]) よりも早く
+// タイムアウトする。
+static struct timer *timers[NUM_TIMERS_MAX];
+static int num_timers = 0;
+
+// タイマーaがタイマーbよりも早くタイムアウトするかどうかを返す。
+static bool timer_before(struct timer *a, struct timer *b) {
+    return (int) (a->deadline - b->deadline) < 0;
+}
+
+// ヒープのindex番目にタイマーを置く。
+static void heap_put(int index, struct timer *timer) {
+    timers[index] = timer;
+    timer->index = index;
+}
+
+// index番目のタイマーを、親よりも早くタイムアウトする間だけ上に移動する。
+static void heap_sift_up(int index) {
+    struct timer *timer = timers[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!timer_before(timer, timers[parent])) {
+            break;
+        }
+
+        heap_put(index, timers[parent]);
+        index = parent;
+    }
+
+    heap_put(index, timer);
+}
+
+// index番目のタイマーを、子よりも遅くタイムアウトする間だけ下に移動する。
+static void heap_sift_down(int index) {
+    struct timer *timer = timers[index];
+    while (true) {
+        int child = index * 2 + 1;
+        if (child >= num_timers) {
+            break;
+        }
+
+        // 2つの子のうち、早くタイムアウトする方と比較する
+        int right = child + 1;
+        if (right < num_timers && timer_before(timers[right], timers[child])) {
+            child = right;
+        }
+
+        if (!timer_before(timers[child], timer)) {
+            break;
+        }
+
+        heap_put(index, timers[child]);
+        index = child;
+    }
+
+    heap_put(index, timer);
+}
+
+// タイマーを初期化する。タイムアウトすると handler(arg) が呼ばれる。
+void timer_init(struct timer *timer, void (*handler)(void *arg), void *arg) {
+    timer->index = -1;
+    timer->deadline = 0;
+    timer->handler = handler;
+    timer->arg = arg;
+}
+
+// タイマーを設定する。指定した時間 (ミリ秒) が経過するとタイムアウトする。既に設定されて
+// いる場合は設定し直す。
+void timer_set(struct timer *timer, unsigned ms) {
+    timer_cancel(timer);
+    timer->deadline = arch_uptime_ticks() + ms * (TICK_HZ / 1000);
+
+    // ヒープの末尾に追加して、正しい位置まで移動する
+    ASSERT(num_timers < NUM_TIMERS_MAX);
+    heap_put(num_timers, timer);
+    num_timers++;
+    heap_sift_up(timer->index);
+
+    // 最も早くタイムアウトするタイマーになった場合は、タイマー割り込みを設定し直す
+    if (timer->index == 0) {
+        timer_reload();
+    }
+}
+
+// タイマーを解除する。設定されていない場合は何もしない。
+void timer_cancel(struct timer *timer) {
+    int index = timer->index;
+    if (index < 0) {
+        return;
+    }
+
+    // ヒープの末尾のタイマーを空いた位置に移動して、正しい位置まで移動する
+    timer->index = -1;
+    num_timers--;
+    if (index < num_timers) {
+        struct timer *last = timers[num_timers];
+        heap_put(index, last);
+        heap_sift_up(index);
+        heap_sift_down(last->index);
+    }
+}
+
+// このCPUの次のタイマー割り込みを設定する。実行中タスクのクォンタムが切れる時刻と、最も
+// 早くタイムアウトするタイマーの時刻のうち、早い方で割り込みが発生するようにする。
+// タスクを切り替えたときや、タイマー割り込みを処理したときに呼ぶ。
+//
+// タイマーの処理はどのCPUでも行うので、各CPUは最も早いタイマーの時刻に割り込みを設定
+// する。アイドル状態のCPUは、タイマーがなければ長い間割り込みなしで眠り続ける。
+void timer_reload(void) {
+    unsigned ticks = TIMER_INTERVAL_MAX;
+    struct task *current = CURRENT_TASK;
+    if (current != IDLE_TASK) {
+        ticks = MIN(ticks, current->quantum);
+    }
+
+    if (num_timers > 0) {
+        int remaining = timers[0]->deadline - arch_uptime_ticks();
+        ticks = MIN(ticks, (unsigned) MAX(remaining, 0));
+    }
+
+    arch_set_timer(ticks);
+}
 
 // 割り込み通知を受け付けるようにする。
 error_t irq_listen(struct task *task, unsigned irq) {
@@ -62,24 +183,25 @@ void handle_interrupt(unsigned irq) {
     }
 
     notify(task, NOTIFY_IRQ);
+
+    // 割り込みを待っていたタスクの優先度が高ければ、すぐに切り替える
+    task_preempt();
 }
 
-// タイマー割り込みハンドラ
+// タイマー割り込みハンドラ。ticksはこのCPUで前回呼ばれてから経過した時間。
 void handle_timer_interrupt(unsigned ticks) {
-    // 起動してからの経過時間を更新
-    uptime_ticks += ticks;
-
-    if (CPUVAR->id == 0) {
-        // 各タスクのタイマーを更新する
-        LIST_FOR_EACH (task, &active_tasks, struct task, next) {
-            if (task->timeout > 0) {
-                task->timeout -= MIN(task->timeout, ticks);
-                if (!task->timeout) {
-                    // タイムアウトしたのでタスクに通知する
-                    notify(task, NOTIFY_TIMER);
-                }
-            }
+    // タイムアウトしたタイマーを処理する。ヒープの先頭が最も早くタイムアウトするタイマー
+    // なので、先頭から順に取り出していけばよい。他のCPUが眠っているかもしれないので、どの
+    // CPUでも処理する。
+    unsigned now = arch_uptime_ticks();
+    while (num_timers > 0) {
+        struct timer *timer = timers[0];
+        if ((int) (now - timer->deadline) < 0) {
+            break;
         }
+
+        timer_cancel(timer);
+        timer->handler(timer->arg);
     }
 
     // 実行中タスクの残り実行可能時間を更新し、ゼロになったらタスク切り替えを行う
@@ -88,5 +210,10 @@ void handle_timer_interrupt(unsigned ticks) {
     current->quantum -= MIN(ticks, current->quantum);
     if (!current->quantum) {
         task_switch();
+    } else {
+        task_preempt();
     }
+
+    // 次のタイマー割り込みを設定する
+    timer_reload();
 }
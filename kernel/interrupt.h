@@ -1,7 +1,26 @@
 #pragma once
+#include <libs/common/list.h>
 #include <libs/common/types.h>
 
-extern unsigned uptime_ticks;
+// カーネルが同時に設定できるタイマーの最大数 (各タスクのタイマーとIPCのタイムアウト用)
+#define NUM_TIMERS_MAX (NUM_TASKS_MAX * (TASK_TIMERS_MAX + 1))
+
+// タイマー
+struct timer {
+    int index;                    // タイマーのヒープ内の位置 (-1の場合は未設定)
+    unsigned deadline;            // タイムアウトする時刻 (arch_uptime_ticks)
+    void (*handler)(void *arg);  // タイムアウト時に呼ばれる関数
+    void *arg;                    // handlerに渡す引数
+};
+
+// タイマー割り込みを設定する間隔の上限。経過時間を計算するため、タイマーやタスクが
+// ない場合でも定期的に割り込みを発生させる。
+#define TIMER_INTERVAL_MAX (1000 * (TICK_HZ / 1000)) /* 1秒 */
+
+void timer_init(struct timer *timer, void (*handler)(void *arg), void *arg);
+void timer_set(struct timer *timer, unsigned ms);
+void timer_cancel(struct timer *timer);
+void timer_reload(void);
 
 struct task;
 error_t irq_listen(struct task *task, unsigned irq);
@@ -1,4 +1,6 @@
 #include "ipc.h"
+#include "memory.h"
+#include "slab.h"
 #include "syscall.h"
 #include "task.h"
 #include <libs/common/list.h>
@@ -7,8 +9,397 @@
 #include <libs/common/string.h>
 #include <libs/common/types.h>
 
+// 非同期メッセージ (受信キューの要素)
+struct async_message {
+    list_elem_t next;  // 受信キューの次の要素へのポインタ
+    struct message m;  // メッセージ
+};
+
+// 非同期メッセージのオブジェクトキャッシュ。全タスクで共有する。
+static struct slab_cache async_message_cache =
+    SLAB_CACHE_INIT("async_message", struct async_message);
+
+// メッセージの一部をコピーする。IPC_KERNELフラグが指定されている場合は、srcをカーネル
+// 空間のポインタとして扱う。
+static error_t copy_from(void *dst, __user const void *src, size_t len,
+                         unsigned flags) {
+    if (flags & IPC_KERNEL) {
+        memcpy(dst, (const void *) src, len);
+        return OK;
+    }
+
+    return memcpy_from_user(dst, src, len);
+}
+
+// 受信したメッセージの一部をコピーする。IPC_KERNELフラグが指定されている場合は、dstを
+// カーネル空間のポインタとして扱う。
+static error_t copy_to(__user void *dst, const void *src, size_t len,
+                       unsigned flags) {
+    if (flags & IPC_KERNEL) {
+        memcpy((void *) dst, src, len);
+        return OK;
+    }
+
+    return memcpy_to_user(dst, src, len);
+}
+
+// メッセージを送受信するバッファの一覧を取得する。IPC_IOVフラグが指定されていない場合は、
+// メッセージ全体を1つのバッファとして扱う。
+static error_t get_iovs(struct ipc_iovs *iovs, __user struct message *m,
+                        unsigned flags) {
+    if (!(flags & IPC_IOV)) {
+        iovs->num_iovs = 1;
+        iovs->iovs[0].base = (void *) m;
+        iovs->iovs[0].len = sizeof(struct message);
+        return OK;
+    }
+
+    error_t err = copy_from(iovs, (__user struct ipc_iovs *) m, sizeof(*iovs),
+                            flags);
+    if (err != OK) {
+        return err;
+    }
+
+    if (iovs->num_iovs <= 0 || iovs->num_iovs > IPC_IOV_MAX) {
+        return ERR_INVALID_ARG;
+    }
+
+    return OK;
+}
+
+// 各バッファを連結したもののoffsetバイト目からlenバイトを読み込む。
+static error_t read_iovs(void *dst, const struct ipc_iovs *iovs, size_t offset,
+                         size_t len, unsigned flags) {
+    for (int i = 0; i < iovs->num_iovs && len > 0; i++) {
+        const struct ipc_iovec *iov = &iovs->iovs[i];
+        if (offset >= iov->len) {
+            offset -= iov->len;
+            continue;
+        }
+
+        size_t copy_len = MIN(len, iov->len - offset);
+        error_t err = copy_from(
+            dst, (__user uint8_t *) iov->base + offset, copy_len, flags);
+        if (err != OK) {
+            return err;
+        }
+
+        dst = (uint8_t *) dst + copy_len;
+        len -= copy_len;
+        offset = 0;
+    }
+
+    // バッファの長さの合計が足りない
+    return (len > 0) ? ERR_INVALID_ARG : OK;
+}
+
+// lenバイトを、各バッファの先頭から順に分散して書き込む。
+static error_t write_iovs(const struct ipc_iovs *iovs, const void *src,
+                          size_t len, unsigned flags) {
+    for (int i = 0; i < iovs->num_iovs && len > 0; i++) {
+        const struct ipc_iovec *iov = &iovs->iovs[i];
+        size_t copy_len = MIN(len, iov->len);
+        error_t err = copy_to((__user void *) iov->base, src, copy_len, flags);
+        if (err != OK) {
+            return err;
+        }
+
+        src = (const uint8_t *) src + copy_len;
+        len -= copy_len;
+    }
+
+    // バッファに収まりきらなかった (メッセージの末尾は切り捨てられる)
+    return (len > 0) ? ERR_TOO_LARGE : OK;
+}
+
+// 送信するメッセージをコピーする。メッセージ全体ではなく、メッセージの種類と可変長の
+// バイト列の長さフィールドから、実際に使われている部分のみをコピーする。
+static error_t copy_message(struct message *dst, const struct ipc_iovs *iovs,
+                            unsigned flags) {
+    // メッセージの種類を読み込む
+    error_t err = read_iovs(dst, iovs, 0, MESSAGE_HEADER_LEN, flags);
+    if (err != OK) {
+        return err;
+    }
+
+    // 可変長のバイト列を除いた部分 (長さフィールドを含む) を読み込む
+    size_t offset = MESSAGE_HEADER_LEN;
+    size_t len = msg_fixed_len(dst->type);
+    err = read_iovs((uint8_t *) dst + offset, iovs, offset, len - offset,
+                    flags);
+    if (err != OK) {
+        return err;
+    }
+
+    // 可変長のバイト列のうち、使われている部分を読み込む
+    offset = len;
+    len = msg_len(dst);
+    return read_iovs((uint8_t *) dst + offset, iovs, offset, len - offset,
+                     flags);
+}
+
+// ページ単位のバッファ (ool) を含むメッセージの場合、送信前に内容を検証する。まだマップ
+// されていないページがあれば、ここでページフォルトを起こしてマップさせておく。
+static error_t prepare_ool(struct message *m, unsigned flags) {
+    uaddr_t *addr;
+    size_t *len, max_len;
+    if (!msg_ool(m, &addr, &len, &max_len) || *len == 0) {
+        return OK;
+    }
+
+    if (flags & (IPC_KERNEL | IPC_ASYNC)) {
+        // カーネルはページを送信しない。また、非同期メッセージはキューに入れた後に送信元
+        // タスクの状態が変わりうるため、ページを含められない。
+        return ERR_NOT_SUPPORTED;
+    }
+
+    if (*len > max_len) {
+        return ERR_TOO_LARGE;
+    }
+
+    if (!IS_ALIGNED(*addr, PAGE_SIZE)) {
+        return ERR_INVALID_ARG;
+    }
+
+    for (size_t offset = 0; offset < *len; offset += PAGE_SIZE) {
+        uint8_t tmp;
+        error_t err =
+            memcpy_from_user(&tmp, (__user uint8_t *) (*addr + offset), 1);
+        if (err != OK) {
+            return err;
+        }
+    }
+
+    return OK;
+}
+
+// ページ単位のバッファ (ool) を、実行中タスクから宛先タスクの受信ウィンドウへ移動する。
+// メッセージ中のバッファのアドレスは、宛先タスクにおけるアドレスに書き換える。
+static error_t move_ool(struct task *dst, struct message *m) {
+    uaddr_t *addr;
+    size_t *len, max_len;
+    if (!msg_ool(m, &addr, &len, &max_len)) {
+        return OK;
+    }
+
+    if (*len == 0) {
+        *addr = 0;
+        return OK;
+    }
+
+    if (!dst->ool_window) {
+        // 宛先タスクが受信ウィンドウを指定していない。データを黙って捨てないよう、送信を
+        // 失敗させる。
+        WARN("%s: %s (#%d) does not accept pages (no ool window)",
+             CURRENT_TASK->name, dst->name, dst->tid);
+        return ERR_NOT_SUPPORTED;
+    }
+
+    // ページはアドレス空間を所有するタスク (リーダー) 間で移動する
+    error_t err =
+        vm_move_pages(CURRENT_TASK->leader, *addr, dst->leader, dst->ool_window,
+                      ALIGN_UP(*len, PAGE_SIZE) / PAGE_SIZE);
+    if (err != OK) {
+        return err;
+    }
+
+    *addr = dst->ool_window;
+    return OK;
+}
+
+// 宛先タスクの非同期メッセージキューにメッセージを追加する。キューが一杯の場合は
+// ERR_TRY_AGAINを返す。
+static error_t push_async_message(struct task *dst, struct message *m) {
+    if (dst->num_async_messages >= ASYNC_QUEUE_LEN_MAX) {
+        return ERR_TRY_AGAIN;
+    }
+
+    struct async_message *am = slab_alloc(&async_message_cache);
+    if (!am) {
+        return ERR_TRY_AGAIN;
+    }
+
+    memcpy(&am->m, m, msg_len(m));
+    am->m.src = CURRENT_TASK->tid;
+    list_elem_init(&am->next);
+    list_push_back(&dst->async_messages, &am->next);
+    dst->num_async_messages++;
+    return OK;
+}
+
+// 非同期メッセージキューの先頭のメッセージを取り出す。キューが空の場合はfalseを返す。
+static bool pop_async_message(struct task *task, struct message *m) {
+    struct async_message *am =
+        LIST_POP_FRONT(&task->async_messages, struct async_message, next);
+    if (!am) {
+        return false;
+    }
+
+    memcpy(m, &am->m, msg_len(&am->m));
+    slab_free(&async_message_cache, am);
+    task->num_async_messages--;
+    return true;
+}
+
+// 受信済みの通知をNOTIFY_MSGメッセージに変換する。
+static void build_notify_message(struct task *task, struct message *m) {
+    m->type = NOTIFY_MSG;
+    m->src = FROM_KERNEL;
+    m->notify.notifications = task->notifications;
+    m->notify.timers = task->timers_fired;
+    task->notifications = 0;
+    task->timers_fired = 0;
+}
+
+// 受信するポートの集合を返す。指定されていない場合は全てのポート。
+static unsigned recv_ports(unsigned flags) {
+    unsigned ports = IPC_GET_PORTS(flags);
+    return ports ? ports : (1U << IPC_PORTS_MAX) - 1;
+}
+
+// taskがtidのタスク、またはtidのタスクのスレッドであるかを返す。タスクIDを指定した
+// クローズド受信では、そのタスクのどのスレッドからのメッセージも受け取る。
+static bool is_task_or_thread(struct task *task, task_t tid) {
+    return task->tid == tid || task->leader->tid == tid;
+}
+
+// 宛先タスクdstが、送信元タスクsrcからのメッセージを今すぐ受信できるかを返す。非同期
+// メッセージはオープン受信でのみ受け取るので、クローズド受信 (返信待ちなど) をしている場合
+// は受信できないものとする。
+static bool is_ready_to_receive(struct task *dst, struct task *src,
+                                unsigned flags) {
+    return dst->state == TASK_BLOCKED
+           && (dst->wait_ports & (1U << IPC_GET_PORT(flags)))
+           && (dst->wait_for == IPC_ANY
+               || (is_task_or_thread(src, dst->wait_for)
+                   && !(flags & IPC_ASYNC)));
+}
+
+// 送信待ちタスクの中から、受信するポートの集合portsに含まれるポートへ送信しようとしている
+// タスクを探す。オープン受信の場合は、番号が大きい (優先度が高い) ポートから順に探す。
+static struct task *find_sender(struct task *task, task_t src,
+                                unsigned ports) {
+    if (src != IPC_ANY) {
+        // クローズド受信: 送信元タスクがこのタスクへの送信待ちかどうかを直接確認する
+        struct task *sender = task_find(src);
+        if (!sender) {
+            return NULL;
+        }
+
+        if (sender->state == TASK_BLOCKED && sender->send_to == task
+            && (ports & (1U << sender->send_port))) {
+            return sender;
+        }
+
+        if (list_is_empty(&sender->threads)) {
+            return NULL;
+        }
+
+        // 送信元タスクがスレッドを持っている場合は、そのスレッドも探す
+        for (int port = IPC_PORTS_MAX - 1; port >= 0; port--) {
+            if (!(ports & (1U << port))) {
+                continue;
+            }
+
+            LIST_FOR_EACH (thread, &task->senders[port], struct task,
+                           waitqueue_next) {
+                if (is_task_or_thread(thread, src)) {
+                    return thread;
+                }
+            }
+        }
+
+        return NULL;
+    }
+
+    for (int port = IPC_PORTS_MAX - 1; port >= 0; port--) {
+        list_t *senders = &task->senders[port];
+        if ((ports & (1U << port)) && !list_is_empty(senders)) {
+            return LIST_CONTAINER(senders->next, struct task, waitqueue_next);
+        }
+    }
+
+    return NULL;
+}
+
+// 受信待ちでのスピンの統計情報
+static unsigned spin_attempts = 0;  // スピンした回数
+static unsigned spin_hits = 0;      // スピン中にメッセージを受信できた回数
+
+// 受信相手のタスクsrcが他のCPUで実行中であれば、ブロックする前にカーネルロックを解放して
+// しばらくメッセージが届くのを待つ (アダプティブスピン)。他のCPU上のサーバからすぐに返信が
+// 来る場合は、コンテキストスイッチを2回省ける。実行中タスクが再開された場合はtrueを返す。
+//
+// スピンする回数はタスクごとに、成功すると倍に、失敗すると半分にする。
+static bool spin_for_message(struct task *current, struct task *src) {
+    DEBUG_ASSERT(current->state == TASK_BLOCKED);
+
+    // 受信相手が実行可能状態で、他のCPUで実行中か他のCPUのランキューで実行を待っていれば
+    // スピンする。後者は直前の送信で再開されたIPCの相手で、ランキューに入れたCPUはIPIで
+    // 起こされてすぐに実行する。ページ単位のバッファ (ool) を受け取る場合は、他のCPUから
+    // ページテーブルを書き換えられることになるのでスピンしない。
+    if (!src || src == current || src->state != TASK_RUNNABLE
+        || (list_is_linked(&src->waitqueue_next) && src->cpu == CPUVAR->id)
+        || current->ool_window) {
+        return false;
+    }
+
+    spin_attempts++;
+    current->spinning = true;
+    arch_unlock();
+
+    for (int i = 0; i < current->spin_budget; i++) {
+        if (atomic_load(&current->state) != TASK_BLOCKED
+            || atomic_load(&current->destroyed)) {
+            break;
+        }
+    }
+
+    arch_lock();
+    current->spinning = false;
+
+    if (current->state == TASK_BLOCKED) {
+        // スピン中にメッセージが届かなかった。次回のスピンを短くする。
+        current->spin_budget = MAX(current->spin_budget / 2, IPC_SPIN_MIN);
+        return false;
+    }
+
+    // スピン中に再開された。次回のスピンを長くする。
+    current->spin_budget = MIN(current->spin_budget * 2, IPC_SPIN_MAX);
+    if (!current->ipc_timed_out) {
+        spin_hits++;
+    }
+
+    return true;
+}
+
+// IPCのタイムアウト用のタイマーを設定する。ブロックする直前に呼ぶ。
+static void start_ipc_timer(struct task *task, unsigned flags) {
+    task->ipc_timed_out = false;
+    unsigned timeout = flags & IPC_TIMEOUT_MAX;
+    if (timeout) {
+        timer_set(&task->ipc_timer, timeout);
+    }
+}
+
+// IPCのタイムアウト時間が経過した。送受信待ちでブロックしているタスクを再開させる。
+void ipc_handle_timeout(void *arg) {
+    struct task *task = arg;
+    if (task->state != TASK_BLOCKED) {
+        // タイマーが解除される前に、既にメッセージを送受信して再開されている
+        return;
+    }
+
+    // 送信待ちの場合は宛先タスクの送信待ちキューから取り除く
+    list_remove(&task->waitqueue_next);
+    task->send_to = NULL;
+    task->wait_for = IPC_DENY;
+    task->ipc_timed_out = true;
+    task_resume(task);
+}
+
 // メッセージの送信処理
-static error_t send_message(struct task *dst, __user struct message *m,
+static error_t send_message(struct task *dst, const struct ipc_iovs *iovs,
                             unsigned flags) {
     // 自分自身にはメッセージを送信できない
     struct task *current = CURRENT_TASK;
@@ -20,122 +411,191 @@ static error_t send_message(struct task *dst, __user struct message *m,
     // 送信するメッセージをコピーする。ユーザーポインタの場合、ページフォルトが発生する可能性
     // があるので注意
     struct message copied_m;
-    if (flags & IPC_KERNEL) {
-        memcpy(&copied_m, (struct message *) m, sizeof(struct message));
-    } else {
-        error_t err = memcpy_from_user(&copied_m, m, sizeof(struct message));
-        if (err != OK) {
-            return err;
-        }
+    error_t err = copy_message(&copied_m, iovs, flags);
+    if (err != OK) {
+        return err;
     }
 
-    // 送信先がメッセージを待っているか確認
-    bool ready = dst->state == TASK_BLOCKED
-                 && (dst->wait_for == IPC_ANY || dst->wait_for == current->tid);
-    if (!ready) {
-        if (flags & IPC_NOBLOCK) {
+    err = prepare_ool(&copied_m, flags);
+    if (err != OK) {
+        return err;
+    }
+
+    // 送信先がメッセージを待っているか確認。待っていなければ、受信状態になるまで待つ。
+    while (!is_ready_to_receive(dst, current, flags)) {
+        if (flags & IPC_ASYNC) {
+            // 宛先タスクの非同期メッセージキューに入れて、ブロックせずに戻る
+            return push_async_message(dst, &copied_m);
+        }
+
+        // 返信 (IPC_REPLY) の場合も、宛先タスクが受信待ちでなければブロックしない
+        if (flags & (IPC_NOBLOCK | IPC_REPLY)) {
             return ERR_WOULD_BLOCK;
         }
 
         // 互いにメッセージを送り合おうとしている場合はデッドロックになるので、エラーを返す。
-        LIST_FOR_EACH (task, &current->senders, struct task, waitqueue_next) {
-            if (task->tid == dst->tid) {
-                WARN(
-                    "dead lock detected: %s (#%d) and %s (#%d) are trying to"
-                    " send messages to each other"
-                    " (hint: consider using ipc_send_async())",
-                    current->name, current->tid, dst->name, dst->tid);
-                return ERR_DEAD_LOCK;
-            }
+        if (dst->state == TASK_BLOCKED && dst->send_to == current) {
+            WARN(
+                "dead lock detected: %s (#%d) and %s (#%d) are trying to"
+                " send messages to each other"
+                " (hint: consider using ipc_send_async())",
+                current->name, current->tid, dst->name, dst->tid);
+            return ERR_DEAD_LOCK;
         }
 
-        // 宛先の送信待ちキューに実行中タスクを追加し、ブロック状態にする
-        list_push_back(&dst->senders, &current->waitqueue_next);
+        // 宛先ポートの送信待ちキューに実行中タスクを追加し、ブロック状態にする
+        unsigned port = IPC_GET_PORT(flags);
+        list_push_back(&dst->senders[port], &current->waitqueue_next);
+        current->send_to = dst;
+        current->send_port = port;
         task_block(current);
+        start_ipc_timer(current, flags);
 
         // CPUを他のタスクに譲る。宛先タスクが受信状態になると、このタスクが再開される
         task_switch();
+        timer_cancel(&current->ipc_timer);
+        current->send_to = NULL;
 
         // 宛先タスクが終了した場合は送信処理を中断する
         if (current->notifications & NOTIFY_ABORTED) {
             current->notifications &= ~NOTIFY_ABORTED;
             return ERR_ABORTED;
         }
+
+        // タイムアウトした
+        if (current->ipc_timed_out) {
+            return ERR_TIMEOUT;
+        }
+
+        // 宛先タスクが受信状態になったので再開された。ただし、再開されるまでの間に宛先
+        // タスクの受信がタイムアウトしている可能性があるので、もう一度確認する。
+    }
+
+    // ページ単位のバッファがあれば、宛先タスクへ移動する
+    err = move_ool(dst, &copied_m);
+    if (err != OK) {
+        return err;
+    }
+
+    // このまま返信を待つ (IPC_CALL) 場合か、宛先タスクがこのタスクからの返信を待っている
+    // 場合は、次に受信待ちでブロックするときに宛先タスクへ直接切り替える。
+    if ((flags & IPC_RECV) || is_task_or_thread(current, dst->wait_for)) {
+        current->handoff = dst->tid;
     }
 
     // メッセージを送信して、宛先タスクを再開する
-    memcpy(&dst->m, &copied_m, sizeof(struct message));
+    memcpy(&dst->m, &copied_m, msg_len(&copied_m));
     dst->m.src = (flags & IPC_KERNEL) ? FROM_KERNEL : current->tid;
     task_resume(dst);
     return OK;
 }
 
 // メッセージの受信処理
-static error_t recv_message(task_t src, __user struct message *m,
-                            unsigned flags) {
+static error_t recv_message(task_t src, const struct ipc_iovs *iovs,
+                            unsigned flags, uaddr_t ool_window) {
     struct task *current = CURRENT_TASK;
+    struct task *handoff = task_find(current->handoff);
+    current->handoff = 0;
+
+    // 通知と非同期メッセージはポート0に届く。それよりも優先度の高いポートへの送信待ち
+    // タスクがいれば、そちらを先に受信する。
+    unsigned ports = recv_ports(flags);
+    struct task *sender = find_sender(current, src, ports & ~1U);
+    bool port0 = !sender && src == IPC_ANY && (ports & 1);
+
     struct message copied_m;
-    if (src == IPC_ANY && current->notifications) {
+    if (port0 && current->notifications) {
         // 通知がある場合は、それをメッセージとして受信する
-        copied_m.type = NOTIFY_MSG;
-        copied_m.src = FROM_KERNEL;
-        copied_m.notify.notifications = current->notifications;
-        current->notifications = 0;
+        build_notify_message(current, &copied_m);
+    } else if (port0 && !(flags & IPC_KERNEL)
+               && !list_is_empty(&current->async_messages)) {
+        // 非同期メッセージキューにメッセージがあれば、それを受信する
+        pop_async_message(current, &copied_m);
     } else {
         if (flags & IPC_NOBLOCK) {
             return ERR_WOULD_BLOCK;
         }
 
         // 送信待ちキューに `src` に合致するタスクがあれば、それを再開する
-        LIST_FOR_EACH (sender, &current->senders, struct task, waitqueue_next) {
-            if (src == IPC_ANY || src == sender->tid) {
-                DEBUG_ASSERT(sender->state == TASK_BLOCKED);
-                DEBUG_ASSERT(sender->wait_for == IPC_DENY);
-                list_remove(&sender->waitqueue_next);
-                task_resume(sender);
-                src = sender->tid;
-                break;
+        if (!sender) {
+            sender = find_sender(current, src, ports & 1);
+        }
+
+        if (sender) {
+            DEBUG_ASSERT(sender->state == TASK_BLOCKED);
+            DEBUG_ASSERT(sender->wait_for == IPC_DENY);
+            list_remove(&sender->waitqueue_next);
+            task_resume(sender);
+            src = sender->tid;
+            if (!handoff) {
+                handoff = sender;
             }
         }
 
-        // メッセージを受信するまで待つ
+        // ページ単位のバッファの受信先を設定する。カーネルはページを受け取らない。
+        current->ool_window = (flags & IPC_KERNEL) ? 0 : ool_window;
+
+        // メッセージを受信するまで待つ。通信相手がいれば、ランキューを経由せずにそのタスク
+        // へ直接切り替える。直接切り替えられない場合 (相手が他のCPUでしか実行できない場合
+        // など) は、相手が他のCPUで送信してくるのをスピンして待ってからブロックする。
         current->wait_for = src;
+        current->wait_ports = ports;
         task_block(current);
-        task_switch();
+        start_ipc_timer(current, flags);
+        if (!(handoff && task_switch_to(handoff))
+            && !spin_for_message(current, task_find(src))) {
+            task_switch();
+        }
 
-        // メッセージを受け取った
+        timer_cancel(&current->ipc_timer);
         current->wait_for = IPC_DENY;
-        memcpy(&copied_m, &current->m, sizeof(struct message));
-    }
-
-    // 受信したメッセージをコピーする。ユーザーポインタの場合、ページフォルトが発生する可能性
-    // があるので注意
-    if (flags & IPC_KERNEL) {
-        memcpy((void *) m, &copied_m, sizeof(struct message));
-    } else {
-        error_t err = memcpy_to_user(m, &copied_m, sizeof(struct message));
-        if (err != OK) {
-            return err;
+        current->wait_ports = 0;
+        current->ool_window = 0;
+        if (current->ipc_timed_out) {
+            return ERR_TIMEOUT;
         }
+
+        // メッセージを受け取った
+        memcpy(&copied_m, &current->m, msg_len(&current->m));
     }
 
-    return OK;
+    // 受信したメッセージをコピーする。メッセージ全体ではなく、実際に使われている部分のみを
+    // コピーする。ユーザーポインタの場合、ページフォルトが発生する可能性があるので注意
+    return write_iovs(iovs, &copied_m, msg_len(&copied_m), flags);
 }
 
-// メッセージを送受信する。
+// メッセージを送受信する。ool_windowは、ページ単位のバッファ (ool) を含むメッセージを
+// 受信した際に、そのページをマップするアドレス (0の場合は受け取らない)。
+//
+// IPC_IOVフラグが指定されている場合、mはstruct ipc_iovsを指す。送信時は各バッファを連結
+// したものをメッセージとして送信し、受信時はメッセージを各バッファへ順に分散して書き込む。
 error_t ipc(struct task *dst, task_t src, __user struct message *m,
-            unsigned flags) {
+            unsigned flags, uaddr_t ool_window) {
+    struct ipc_iovs iovs;
+    error_t err = get_iovs(&iovs, m, flags);
+    if (err != OK) {
+        return err;
+    }
+
     // 送信操作
     if (flags & IPC_SEND) {
-        error_t err = send_message(dst, m, flags);
+        err = send_message(dst, &iovs, flags);
         if (err != OK) {
-            return err;
+            if (!(flags & IPC_REPLY)) {
+                return err;
+            }
+
+            // 返信に失敗した場合は警告メッセージを出力して返信を破棄し、そのまま受信操作
+            // に移る。返信はサーバからクライアントへの一方的なもので、サーバは返信の失敗を
+            // 待ってまで対処する必要がない。
+            WARN("%s: failed to reply to #%d: %s", CURRENT_TASK->name,
+                 dst->tid, err2str(err));
         }
     }
 
     // 受信操作
     if (flags & IPC_RECV) {
-        error_t err = recv_message(src, m, flags);
+        err = recv_message(src, &iovs, flags, ool_window);
         if (err != OK) {
             return err;
         }
@@ -144,18 +604,37 @@ error_t ipc(struct task *dst, task_t src, __user struct message *m,
     return OK;
 }
 
+// 削除されるタスクのIPC関連の資源を解放する。非同期メッセージキューに残っているメッセージを
+// 破棄する。
+void ipc_cleanup(struct task *task) {
+    while (true) {
+        struct async_message *am =
+            LIST_POP_FRONT(&task->async_messages, struct async_message, next);
+        if (!am) {
+            break;
+        }
+
+        slab_free(&async_message_cache, am);
+    }
+
+    task->num_async_messages = 0;
+}
+
 // 通知を送信する。
 void notify(struct task *dst, notifications_t notifications) {
-    if (dst->state == TASK_BLOCKED && dst->wait_for == IPC_ANY) {
+    dst->notifications |= notifications;
+    if (dst->state == TASK_BLOCKED && dst->wait_for == IPC_ANY
+        && (dst->wait_ports & 1)) {
         // 宛先タスクがオープン受信状態で待っている。NOTIFY_MSGメッセージを送った体で
         // 通知を即座に配送する。
-        dst->m.type = NOTIFY_MSG;
-        dst->m.src = FROM_KERNEL;
-        dst->m.notify.notifications = dst->notifications | notifications;
-        dst->notifications = 0;
+        build_notify_message(dst, &dst->m);
         task_resume(dst);
-    } else {
-        // 宛先タスクがオープン受信をするまで通知を保留する。
-        dst->notifications |= notifications;
     }
+
+    // それ以外の場合は、宛先タスクがオープン受信をするまで通知を保留する。
+}
+
+// デバッグ用にIPCの統計情報を表示する。
+void ipc_dump(void) {
+    WARN("IPC spin: %u/%u succeeded", spin_hits, spin_attempts);
 }
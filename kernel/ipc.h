@@ -1,8 +1,18 @@
 #pragma once
 #include <libs/common/types.h>
 
+// 各タスクの非同期メッセージキューの最大長
+#define ASYNC_QUEUE_LEN_MAX 32
+
+// 受信待ちでブロックする前にスピンする回数の下限と上限 (アダプティブスピン)
+#define IPC_SPIN_MIN 64
+#define IPC_SPIN_MAX 8192
+
 struct task;
 struct message;
 error_t ipc(struct task *dst, task_t src, __user struct message *m,
-            unsigned flags);
+            unsigned flags, uaddr_t ool_window);
 void notify(struct task *dst, notifications_t notifications);
+void ipc_handle_timeout(void *arg);
+void ipc_cleanup(struct task *task);
+void ipc_dump(void);
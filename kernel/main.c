@@ -2,6 +2,7 @@
 #include "arch.h"
 #include "memory.h"
 #include "printk.h"
+#include "slab.h"
 #include "task.h"
 #include <libs/common/elf.h>
 #include <libs/common/string.h>
@@ -70,7 +71,16 @@ static void create_first_task(struct bootinfo *bootinfo) {
 __noreturn static void idle_task(void) {
     for (;;) {
         task_switch();
-        arch_idle();
+
+        // 実行するタスクがなければ、空きページをゼロクリアしておく。1ページごとに
+        // 実行可能なタスクが現れていないか確認する。ゼロクリアにはカーネルロックが不要
+        // なので、その間は他のCPUがカーネルに入れるようにロックを解放しておく。
+        arch_unlock();
+        bool filled = pm_fill_zeroed_pool();
+        arch_lock();
+        if (!filled) {
+            arch_idle();
+        }
     }
 }
 
@@ -79,6 +89,8 @@ __noreturn static void idle_task(void) {
 void kernel_main(struct bootinfo *bootinfo) {
     printf("Booting HinaOS...\n");
     memory_init(bootinfo);
+    pm_selftest();
+    slab_selftest();
     arch_init();
     task_init_percpu();
     create_first_task(bootinfo);
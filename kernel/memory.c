@@ -2,30 +2,201 @@
 #include "arch.h"
 #include "ipc.h"
 #include "printk.h"
+#include "spinlock.h"
 #include "task.h"
 #include <libs/common/string.h>
 
+// 1ページに収まるフレーム表の要素数
+#define FRAME_TABLE_ENTRIES (PAGE_SIZE / sizeof(struct memory_zone *))
+// 物理アドレス空間全体を覆うのに必要なフレーム表の数
+#define NUM_FRAME_TABLES ((1ULL << (32 - PFN_OFFSET)) / FRAME_TABLE_ENTRIES)
+
+// ゼロクリア済みのページを保持しておく最大数
+#define ZEROED_POOL_SIZE 64
+
 // 物理メモリの各連続領域 (ゾーン) のリスト。
 static list_t zones = LIST_INIT(zones);
+// 物理ページ番号からゾーンを引くための2段の表 (フレーム表)。ゾーンのない範囲の表は
+// 割り当てない。
+static struct memory_zone **frame_tables[NUM_FRAME_TABLES];
+// バディアロケータの空きリストとゼロクリア済みページのプールを保護するロック。カーネル
+// ロックを持っていないアイドル状態のCPUもプールを満たすために使う。ページ管理構造体の
+// 参照カウントや所有者、CPUごとのページキャッシュはカーネルロックで保護されている。
+static struct spinlock pm_lock = SPINLOCK_INIT("pm");
+// アイドル状態のCPUがあらかじめゼロクリアしておいた空きページのプール
+static paddr_t zeroed_pool[ZEROED_POOL_SIZE];
+static unsigned zeroed_pool_count = 0;   // プール内のページ数
+static unsigned zeroed_pool_hits = 0;    // プールから割り当てられた回数
+static unsigned zeroed_pool_misses = 0;  // プールが空でゼロクリアした回数
 
 // 物理アドレスに対応するゾーンを探す。
+static struct memory_zone *find_zone_by_paddr(paddr_t paddr) {
+    pfn_t pfn = PADDR2PFN(paddr);
+    struct memory_zone **table = frame_tables[pfn / FRAME_TABLE_ENTRIES];
+    if (!table) {
+        return NULL;
+    }
+
+    return table[pfn % FRAME_TABLE_ENTRIES];
+}
+
+// 物理アドレスに対応するページ管理構造体を探す。
 static struct page *find_page_by_paddr(paddr_t paddr,
                                        enum memory_zone_type *zone_type) {
     DEBUG_ASSERT(IS_ALIGNED(paddr, PAGE_SIZE));
 
+    struct memory_zone *zone = find_zone_by_paddr(paddr);
+    if (!zone) {
+        return NULL;
+    }
+
+    if (zone_type) {
+        *zone_type = zone->type;
+    }
+
+    size_t start = (paddr - zone->base) / PAGE_SIZE;
+    return &zone->pages[start];
+}
+
+// ゾーン内のindex番目から始まるオーダーorderのブロックを空きリストに追加する。
+static void push_free_block(struct memory_zone *zone, size_t index, int order) {
+    struct page *head = &zone->pages[index];
+    head->order = order;
+    list_push_back(&zone->free_lists[order], &head->next);
+}
+
+// ゾーン内のindex番目から始まるオーダーorderのブロックを解放する。バディ (対になる同じ
+// オーダーのブロック) も空いていれば、結合してより大きなブロックにする。
+static void free_block(struct memory_zone *zone, size_t index, int order) {
+    // ブロックは物理ページ番号でアラインされているので、バディの物理ページ番号はビットを
+    // 1つ反転させるだけで求まる。
+    size_t base_pfn = PADDR2PFN(zone->base);
+    while (order < PM_ORDER_MAX) {
+        size_t buddy_pfn = (base_pfn + index) ^ (1U << order);
+        if (buddy_pfn < base_pfn || buddy_pfn >= base_pfn + zone->num_pages) {
+            break;
+        }
+
+        struct page *buddy = &zone->pages[buddy_pfn - base_pfn];
+        if (buddy->order != order) {
+            // バディは使用中か、分割されている
+            break;
+        }
+
+        // バディを空きリストから取り除いて結合する
+        list_remove(&buddy->next);
+        buddy->order = PM_ORDER_NONE;
+        index = MIN(index, buddy_pfn - base_pfn);
+        order++;
+    }
+
+    push_free_block(zone, index, order);
+}
+
+// ゾーン内のstart番目からnum_pages個の空きページを、アラインされたブロックに分けて空き
+// リストに追加する。
+static void free_range(struct memory_zone *zone, size_t start,
+                       size_t num_pages) {
+    size_t base_pfn = PADDR2PFN(zone->base);
+    size_t end = start + num_pages;
+    while (start < end) {
+        // 物理ページ番号がアラインされている中で、最も大きなブロックを作る
+        int order = 0;
+        while (order < PM_ORDER_MAX
+               && IS_ALIGNED(base_pfn + start, 1U << (order + 1))
+               && start + (1U << (order + 1)) <= end) {
+            order++;
+        }
+
+        free_block(zone, start, order);
+        start += 1U << order;
+    }
+}
+
+// num_pages個の物理ページを格納できる最小のオーダーを返す。
+static int size_to_order(size_t num_pages) {
+    int order = 0;
+    while ((1U << order) < num_pages) {
+        order++;
+    }
+
+    return order;
+}
+
+// ゾーンからnum_pages個の連続した空きページを取り出し、先頭ページの番号を返す。空きが
+// ない場合は-1を返す。ブロックはその大きさで物理アドレスがアラインされている。
+static long alloc_block(struct memory_zone *zone, size_t num_pages) {
+    // 要求を満たす最も小さい空きブロックを探す
+    int order = size_to_order(num_pages);
+    int found = order;
+    while (found <= PM_ORDER_MAX && list_is_empty(&zone->free_lists[found])) {
+        found++;
+    }
+
+    if (found > PM_ORDER_MAX) {
+        return -1;
+    }
+
+    struct page *head =
+        LIST_POP_FRONT(&zone->free_lists[found], struct page, next);
+    head->order = PM_ORDER_NONE;
+    size_t index = head - zone->pages;
+
+    // 大きすぎるブロックであれば半分に分割していき、後半を空きリストに戻す
+    while (found > order) {
+        found--;
+        push_free_block(zone, index + (1U << found), found);
+    }
+
+    // 2のべき乗に切り上げた分の余りのページを空きリストに戻す
+    free_range(zone, index + num_pages, (1U << order) - num_pages);
+    return index;
+}
+
+// バディアロケータからnum_pages個の連続した物理ページを割り当てる。pagesには先頭ページの
+// 管理構造体を返す。空きがない場合は0を返す。pm_lockを持った状態で呼ぶ。
+static paddr_t alloc_pages(size_t num_pages, struct page **pages) {
+    DEBUG_ASSERT(pm_lock.owner == CPUVAR->id);
+
     LIST_FOR_EACH (zone, &zones, struct memory_zone, next) {
-        if (zone->base <= paddr
-            && paddr < zone->base + zone->num_pages * PAGE_SIZE) {
-            size_t start = (paddr - zone->base) / PAGE_SIZE;
+        if (zone->type != MEMORY_ZONE_FREE) {
+            // MMIO領域は使えない
+            continue;
+        }
 
-            if (zone_type) {
-                *zone_type = zone->type;
-            }
-            return &zone->pages[start];
+        long start = alloc_block(zone, num_pages);
+        if (start >= 0) {
+            *pages = &zone->pages[start];
+            return zone->base + start * PAGE_SIZE;
         }
     }
 
-    return NULL;
+    return 0;
+}
+
+// ゾーンの各物理ページをフレーム表に登録する。
+static void register_frames(struct memory_zone *zone) {
+    pfn_t base_pfn = PADDR2PFN(zone->base);
+    for (size_t i = 0; i < zone->num_pages; i++) {
+        pfn_t pfn = base_pfn + i;
+        struct memory_zone **table = frame_tables[pfn / FRAME_TABLE_ENTRIES];
+        if (!table) {
+            // フレーム表を割り当てる。pm_alloc関数はフレーム表を引くので使えない。
+            struct page *page;
+            spin_lock(&pm_lock);
+            paddr_t paddr = alloc_pages(1, &page);
+            spin_unlock(&pm_lock);
+            ASSERT(paddr != 0);
+            page->ref_count = 1;
+            page->owner = NULL;
+
+            table = (struct memory_zone **) arch_paddr_to_vaddr(paddr);
+            memset(table, 0, PAGE_SIZE);
+            frame_tables[pfn / FRAME_TABLE_ENTRIES] = table;
+        }
+
+        table[pfn % FRAME_TABLE_ENTRIES] = zone;
+    }
 }
 
 // ゾーンを追加する。
@@ -36,74 +207,227 @@ static void add_zone(struct memory_zone *zone, enum memory_zone_type type,
     zone->num_pages = num_pages;
     for (size_t i = 0; i < num_pages; i++) {
         zone->pages[i].ref_count = 0;
+        zone->pages[i].order = PM_ORDER_NONE;
+        zone->pages[i].zone = zone;
+        list_elem_init(&zone->pages[i].next);
+    }
+
+    for (int i = 0; i <= PM_ORDER_MAX; i++) {
+        list_init(&zone->free_lists[i]);
+    }
+
+    // 空き領域であれば、全ページを空きリストに追加する
+    if (type == MEMORY_ZONE_FREE) {
+        spin_lock(&pm_lock);
+        free_range(zone, 0, num_pages);
+        spin_unlock(&pm_lock);
     }
 
     list_elem_init(&zone->next);
     list_push_back(&zones, &zone->next);
+    register_frames(zone);
 }
 
-// start番目からnum_pages個の物理ページが空いているかどうかを返す。
-static bool is_contiguously_free(struct memory_zone *zone, size_t start,
-                                 size_t num_pages) {
-    for (size_t i = 0; i < num_pages; i++) {
-        if (zone->pages[start + i].ref_count != 0) {
-            return false;
+// 空きページを1つバディアロケータに返す。pm_lockを持った状態で呼ぶ。
+static void free_to_buddy(paddr_t paddr) {
+    DEBUG_ASSERT(pm_lock.owner == CPUVAR->id);
+
+    struct memory_zone *zone = find_zone_by_paddr(paddr);
+    DEBUG_ASSERT(zone != NULL);
+    free_block(zone, (paddr - zone->base) / PAGE_SIZE, 0);
+}
+
+// キャッシュの先頭 (最も前に解放された) からnum_pages個のページをバディアロケータに返す。
+static void drain_page_cache(struct page_cache *cache, unsigned num_pages) {
+    num_pages = MIN(num_pages, cache->count);
+    spin_lock(&pm_lock);
+    for (unsigned i = 0; i < num_pages; i++) {
+        free_to_buddy(cache->pages[i]);
+    }
+    spin_unlock(&pm_lock);
+
+    cache->count -= num_pages;
+    memmove(&cache->pages[0], &cache->pages[num_pages],
+            cache->count * sizeof(paddr_t));
+}
+
+// 全CPUのページキャッシュとゼロクリア済みページのプールを空にする。これらのページは結合
+// できないので、連続した領域の割り当てに失敗したときに呼ぶ。カーネルロックで保護されている
+// ので、他のCPUのキャッシュも操作できる。
+static void drain_all_page_caches(void) {
+    for (int i = 0; i < NUM_CPUS_MAX; i++) {
+        struct page_cache *cache = &arch_cpuvar_of(i)->page_cache;
+        drain_page_cache(cache, cache->count);
+    }
+
+    spin_lock(&pm_lock);
+    while (zeroed_pool_count > 0) {
+        free_to_buddy(zeroed_pool[--zeroed_pool_count]);
+    }
+    spin_unlock(&pm_lock);
+}
+
+// ゼロクリア済みページのプールから1ページを割り当てる。プールが空の場合は0を返す。
+static paddr_t alloc_zeroed_page(struct page **page) {
+    spin_lock(&pm_lock);
+    if (zeroed_pool_count == 0) {
+        zeroed_pool_misses++;
+        spin_unlock(&pm_lock);
+        return 0;
+    }
+
+    zeroed_pool_hits++;
+    paddr_t paddr = zeroed_pool[--zeroed_pool_count];
+    spin_unlock(&pm_lock);
+
+    *page = find_page_by_paddr(paddr, NULL);
+    return paddr;
+}
+
+// ゼロクリア済みページのプールに空きがあれば、空きページを1つゼロクリアしてプールに追加する。
+// アイドルタスクから呼ばれ、ページを追加した場合は真を返す。
+//
+// pm_lockだけを使うので、カーネルロックを持たずに呼び出せる。ゼロクリアの間はpm_lockも
+// 解放するので、他のCPUの処理を妨げない。
+bool pm_fill_zeroed_pool(void) {
+    spin_lock(&pm_lock);
+    if (zeroed_pool_count == ZEROED_POOL_SIZE) {
+        spin_unlock(&pm_lock);
+        return false;
+    }
+
+    // 取り出したページはどの空きリストにも入っていないので、ロックを解放している間に他の
+    // CPUに割り当てられることはない。
+    struct page *unused;
+    paddr_t paddr = alloc_pages(1, &unused);
+    spin_unlock(&pm_lock);
+    if (!paddr) {
+        return false;
+    }
+
+    memset((void *) arch_paddr_to_vaddr(paddr), 0, PAGE_SIZE);
+
+    spin_lock(&pm_lock);
+    bool added = zeroed_pool_count < ZEROED_POOL_SIZE;
+    if (added) {
+        zeroed_pool[zeroed_pool_count++] = paddr;
+    } else {
+        // ロックを解放している間に他のCPUがプールを満たした
+        free_to_buddy(paddr);
+    }
+    spin_unlock(&pm_lock);
+    return added;
+}
+
+// 実行中CPUのページキャッシュから1ページを割り当てる。キャッシュが空の場合はバディ
+// アロケータからまとめて補充する。
+static paddr_t alloc_cached_page(struct page **page) {
+    struct page_cache *cache = &CPUVAR->page_cache;
+    if (cache->count == 0) {
+        struct page *unused;
+        spin_lock(&pm_lock);
+        while (cache->count < PAGE_CACHE_BATCH) {
+            paddr_t paddr = alloc_pages(1, &unused);
+            if (!paddr) {
+                break;
+            }
+
+            cache->pages[cache->count++] = paddr;
+        }
+        spin_unlock(&pm_lock);
+
+        if (cache->count == 0) {
+            return 0;
         }
     }
-    return true;
+
+    paddr_t paddr = cache->pages[--cache->count];
+    *page = find_page_by_paddr(paddr, NULL);
+    return paddr;
+}
+
+// 空きページを1つ実行中CPUのページキャッシュに入れる。キャッシュが一杯の場合は古いものから
+// まとめてバディアロケータに返す。
+static void free_cached_page(paddr_t paddr) {
+    struct page_cache *cache = &CPUVAR->page_cache;
+    if (cache->count == PAGE_CACHE_SIZE) {
+        drain_page_cache(cache, PAGE_CACHE_BATCH);
+    }
+
+    cache->pages[cache->count++] = paddr;
 }
 
 // sizeバイトの連続した物理メモリ領域を物理ページ単位で割り当てる。ownerはその領域の
 // 所有者となるタスク。NULLを指定するとカーネルが所有者となる。
 //
+// 空き領域はゾーンごとにバディアロケータで管理しているので、O(log n) で割り当てられる。
+// 1ページの割り当ては、まずCPUごとのページキャッシュから行う。
+//
 // flagsには次のフラグを指定できる。
 //
-// - PM_ALLOC_ZEROED: 物理ページをゼロクリアする
-// - PM_ALLOC_ALIGNED: sizeでアラインされた物理メモリアドレスを返す
+// - PM_ALLOC_ZEROED: 物理ページをゼロクリアする (1ページの場合はゼロクリア済みのページの
+//   プールから割り当てる)
+// - PM_ALLOC_ALIGNED: sizeでアラインされた物理メモリアドレスを返す (バディアロケータが
+//   返すブロックは常にアラインされている)
 paddr_t pm_alloc(size_t size, struct task *owner, unsigned flags) {
     size_t aligned_size = ALIGN_UP(size, PAGE_SIZE);  // 実際に割り当てるサイズ
     size_t num_pages = aligned_size / PAGE_SIZE;      // 割り当てる物理ページ数
-    LIST_FOR_EACH (zone, &zones, struct memory_zone, next) {
-        if (zone->type != MEMORY_ZONE_FREE) {
-            // MMIO領域は使えない
-            continue;
-        }
+    if (num_pages == 0 || num_pages > (1U << PM_ORDER_MAX)) {
+        WARN("pm: invalid allocation size: %d", size);
+        return 0;
+    }
 
-        // 各start番目からnum_pages個の物理ページが空いているかどうかを調べる。
-        for (size_t start = 0; start < zone->num_pages; start++) {
-            paddr_t paddr = zone->base + start * PAGE_SIZE;
-            if ((flags & PM_ALLOC_ALIGNED) != 0
-                && !IS_ALIGNED(paddr, aligned_size)) {
-                // アラインメントが合わないのでスキップ
-                continue;
-            }
+    struct page *pages;
+    paddr_t paddr = 0;
+    bool zeroed = false;
+    if (num_pages == 1 && (flags & PM_ALLOC_ZEROED)) {
+        paddr = alloc_zeroed_page(&pages);
+        zeroed = paddr != 0;
+    }
 
-            if (is_contiguously_free(zone, start, num_pages)) {
-                // 空いているので各物理ページを割り当てる
-                for (size_t i = 0; i < num_pages; i++) {
-                    struct page *page = &zone->pages[start + i];
-                    page->ref_count = 1;
-                    page->owner = owner;
-                    list_elem_init(&page->next);
-
-                    if (owner) {
-                        list_push_back(&owner->pages, &page->next);
-                    }
-                }
-
-                // 必要があればゼロクリアする
-                if (flags & PM_ALLOC_ZEROED) {
-                    memset((void *) arch_paddr_to_vaddr(paddr), 0,
-                           PAGE_SIZE * num_pages);
-                }
-
-                return paddr;
-            }
+    if (!paddr && num_pages == 1) {
+        paddr = alloc_cached_page(&pages);
+    }
+
+    if (!paddr) {
+        spin_lock(&pm_lock);
+        paddr = alloc_pages(num_pages, &pages);
+        spin_unlock(&pm_lock);
+    }
+
+    if (!paddr) {
+        // 各CPUのキャッシュにあるページを戻して空き領域を結合させてから再試行する
+        drain_all_page_caches();
+        spin_lock(&pm_lock);
+        paddr = alloc_pages(num_pages, &pages);
+        spin_unlock(&pm_lock);
+    }
+
+    if (!paddr) {
+        WARN("pm: run out of memory");
+        return 0;
+    }
+
+    // 各物理ページを割り当てる
+    DEBUG_ASSERT(IS_ALIGNED(paddr, PAGE_SIZE << size_to_order(num_pages)));
+    for (size_t i = 0; i < num_pages; i++) {
+        struct page *page = &pages[i];
+        DEBUG_ASSERT(page->ref_count == 0);
+        page->ref_count = 1;
+        page->owner = owner;
+        list_elem_init(&page->next);
+
+        if (owner) {
+            list_push_back(&owner->pages, &page->next);
         }
     }
 
-    WARN("pm: run out of memory");
-    return 0;
+    // 必要があればゼロクリアする
+    if ((flags & PM_ALLOC_ZEROED) && !zeroed) {
+        memset((void *) arch_paddr_to_vaddr(paddr), 0, PAGE_SIZE * num_pages);
+    }
+
+    return paddr;
 }
 
 // 物理ページを1つ解放する。
@@ -115,6 +439,27 @@ static void free_page(struct page *page) {
 
     if (page->ref_count == 0) {
         list_remove(&page->next);
+
+        // RAM上のページであれば実行中CPUのページキャッシュに入れる
+        struct memory_zone *zone = page->zone;
+        if (zone->type == MEMORY_ZONE_FREE) {
+            free_cached_page(zone->base + (page - zone->pages) * PAGE_SIZE);
+        }
+    }
+}
+
+// taskのページテーブルから外したページの、マップされていた分の参照を減らす。ページがtask
+// の所有物で、もうどこにもマップされていない (参照が所有者の分だけになった) 場合は、task
+// からは二度と使われないので所有者の分の参照も減らして解放する。
+static void release_mapping(struct task *task, paddr_t paddr) {
+    enum memory_zone_type zone_type;
+    struct page *page = find_page_by_paddr(paddr, &zone_type);
+    ASSERT(page != NULL);
+
+    free_page(page);
+    if (zone_type == MEMORY_ZONE_FREE && page->owner == task
+        && page->ref_count == 1) {
+        free_page(page);
     }
 }
 
@@ -209,17 +554,85 @@ error_t vm_map(struct task *task, uaddr_t uaddr, paddr_t paddr,
     return OK;
 }
 
-// ページをアンマップ (ページテーブルからの削除) する。
+// ページをアンマップ (ページテーブルからの削除) する。taskが所有していて他にマップされて
+// いないページは解放される。
 error_t vm_unmap(struct task *task, uaddr_t uaddr) {
     if (!arch_is_mappable_uaddr(uaddr)) {
         return ERR_INVALID_ARG;
     }
 
-    error_t err = arch_vm_unmap(&task->vm, uaddr);
+    paddr_t paddr;
+    error_t err = arch_vm_unmap(&task->vm, uaddr, &paddr);
     if (err != OK) {
         return err;
     }
 
+    release_mapping(task, paddr);
+    return OK;
+}
+
+// srcタスクのsrc_uaddrから始まるnum_pages個のページを、dstタスクのdst_uaddrへ移動する
+// (コピーせずにページテーブルを付け替える)。移動したページはsrcタスクからアンマップされ、
+// 所有者もdstタスクに変わる。移動先に既にページがマップされていた場合は、そのページを
+// 解放して置き換える。
+//
+// srcタスクとdstタスクは他のCPUで実行中であってはならない。ただし、どちらかがスレッドを
+// 持つ場合は他のCPUでスレッドが実行中かもしれないので、TLB shootdownを行う。TLB
+// shootdownはカーネルロックを持ったまま行われるので、呼び出し元から見てページの移動は
+// 不可分に行われる。
+error_t vm_move_pages(struct task *src, uaddr_t src_uaddr, struct task *dst,
+                      uaddr_t dst_uaddr, size_t num_pages) {
+    // 移動できるページか確認する。srcタスクが所有し、srcタスクのみがマップしている
+    // RAM上のページのみ移動できる。
+    for (size_t i = 0; i < num_pages; i++) {
+        uaddr_t offset = i * PAGE_SIZE;
+        if (!arch_is_mappable_uaddr(src_uaddr + offset)
+            || !arch_is_mappable_uaddr(dst_uaddr + offset)) {
+            return ERR_INVALID_UADDR;
+        }
+
+        paddr_t paddr;
+        if (arch_vm_lookup(&src->vm, src_uaddr + offset, &paddr) != OK) {
+            WARN("%s: vm_move_pages: %p is not mapped", src->name,
+                 src_uaddr + offset);
+            return ERR_INVALID_UADDR;
+        }
+
+        enum memory_zone_type zone_type;
+        struct page *page = find_page_by_paddr(paddr, &zone_type);
+        if (!page || zone_type != MEMORY_ZONE_FREE || page->owner != src
+            || page->ref_count != 2) {
+            WARN("%s: vm_move_pages: %p is not movable (shared or not owned)",
+                 src->name, src_uaddr + offset);
+            return ERR_NOT_ALLOWED;
+        }
+    }
+
+    for (size_t i = 0; i < num_pages; i++) {
+        uaddr_t offset = i * PAGE_SIZE;
+        paddr_t paddr, replaced;
+        error_t err = arch_vm_move(&src->vm, src_uaddr + offset, &dst->vm,
+                                   dst_uaddr + offset, &paddr, &replaced);
+        if (err != OK) {
+            return err;
+        }
+
+        // 置き換えられたページはアンマップされたのと同じ扱いにする
+        if (replaced) {
+            release_mapping(dst, replaced);
+        }
+
+        // 所有者をdstタスクに変更する。参照カウントは変わらない。
+        struct page *page = find_page_by_paddr(paddr, NULL);
+        list_remove(&page->next);
+        page->owner = dst;
+        list_push_back(&dst->pages, &page->next);
+    }
+
+    if (!list_is_empty(&src->threads) || !list_is_empty(&dst->threads)) {
+        arch_send_ipi(IPI_TLB_FLUSH);
+    }
+
     return OK;
 }
 
@@ -250,12 +663,13 @@ void handle_page_fault(vaddr_t vaddr, vaddr_t ip, unsigned fault) {
     // ページャタスクにページフォルト処理要求メッセージを送信し返信を待つ
     struct message m;
     m.type = PAGE_FAULT_MSG;
-    m.page_fault.task = CURRENT_TASK->tid;
+    m.page_fault.task = CURRENT_TASK->leader->tid;
+    m.page_fault.thread = CURRENT_TASK->tid;
     m.page_fault.uaddr = vaddr;
     m.page_fault.ip = ip;
     m.page_fault.fault = fault;
     error_t err = ipc(pager, pager->tid, (__user struct message *) &m,
-                      IPC_CALL | IPC_KERNEL);
+                      IPC_CALL | IPC_KERNEL, 0);
 
     // ページャタスクからの応答メッセージが正しいかどうかチェックする
     if (err != OK || m.type != PAGE_FAULT_REPLY_MSG) {
@@ -263,6 +677,131 @@ void handle_page_fault(vaddr_t vaddr, vaddr_t ip, unsigned fault) {
     }
 }
 
+// ゾーンの空きブロックの数をオーダーごとに数える。
+static void count_free_blocks(struct memory_zone *zone,
+                              unsigned counts[PM_ORDER_MAX + 1]) {
+    for (int i = 0; i <= PM_ORDER_MAX; i++) {
+        counts[i] = list_len(&zone->free_lists[i]);
+    }
+}
+
+// バディアロケータの自己テスト: 3ページを割り当てると4ページのブロックが分割され、余りの
+// 1ページは空きリストに戻る。1ページずつ解放するとバディと結合され、空きリストは割り当て前
+// と同じ状態に戻るはず。
+static void test_buddy(struct memory_zone *zone) {
+    unsigned before[PM_ORDER_MAX + 1], after[PM_ORDER_MAX + 1];
+
+    spin_lock(&pm_lock);
+    count_free_blocks(zone, before);
+    long index = alloc_block(zone, 3);
+    ASSERT(index >= 0);
+    ASSERT(IS_ALIGNED(PADDR2PFN(zone->base) + index, 4));
+
+    for (int i = 0; i < 3; i++) {
+        free_block(zone, index + i, 0);
+    }
+
+    count_free_blocks(zone, after);
+    spin_unlock(&pm_lock);
+
+    ASSERT(memcmp(before, after, sizeof(before)) == 0);
+    TRACE("pm: buddy split/coalesce OK");
+}
+
+// ページキャッシュの自己テスト: 解放した1ページは実行中CPUのページキャッシュに入り、次の
+// 1ページの割り当てですぐに再利用されるはず。
+static void test_page_cache(void) {
+    paddr_t paddr = pm_alloc(PAGE_SIZE, NULL, PM_ALLOC_UNINITIALIZED);
+    ASSERT(paddr != 0);
+    pm_free(paddr, PAGE_SIZE);
+
+    unsigned count = CPUVAR->page_cache.count;
+    ASSERT(count > 0 && CPUVAR->page_cache.pages[count - 1] == paddr);
+    ASSERT(pm_alloc(PAGE_SIZE, NULL, PM_ALLOC_UNINITIALIZED) == paddr);
+    pm_free(paddr, PAGE_SIZE);
+    TRACE("pm: page cache OK");
+}
+
+// フレーム表の自己テスト: 全ゾーンの全ページについて、物理アドレスから正しいページ管理
+// 構造体とゾーンの種類が引けるはず。
+static void test_page_lookup(void) {
+    LIST_FOR_EACH (zone, &zones, struct memory_zone, next) {
+        for (size_t i = 0; i < zone->num_pages; i++) {
+            enum memory_zone_type type;
+            struct page *page =
+                find_page_by_paddr(zone->base + i * PAGE_SIZE, &type);
+            ASSERT(page == &zone->pages[i] && type == zone->type);
+        }
+    }
+
+    TRACE("pm: page lookup OK");
+}
+
+// ページの中身がすべてゼロかどうかを返す。
+static bool is_zeroed_page(paddr_t paddr) {
+    uint32_t *p = (uint32_t *) arch_paddr_to_vaddr(paddr);
+    for (size_t i = 0; i < PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (p[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// ゼロクリア済みページのプールの自己テスト: プールが空のときは使用済みのページをその場で
+// ゼロクリアして返し、プールを満たした後はプールから割り当てるはず。
+static void test_zeroed_pool(void) {
+    // 使用済みのページをページキャッシュに入れておく
+    paddr_t paddr = pm_alloc(PAGE_SIZE, NULL, PM_ALLOC_UNINITIALIZED);
+    ASSERT(paddr != 0);
+    memset((void *) arch_paddr_to_vaddr(paddr), 0xa5, PAGE_SIZE);
+    pm_free(paddr, PAGE_SIZE);
+
+    ASSERT(zeroed_pool_count == 0);
+    unsigned hits = zeroed_pool_hits;
+    unsigned misses = zeroed_pool_misses;
+    paddr = pm_alloc(PAGE_SIZE, NULL, PM_ALLOC_ZEROED);
+    ASSERT(paddr != 0 && zeroed_pool_misses == misses + 1);
+    ASSERT(is_zeroed_page(paddr));
+    pm_free(paddr, PAGE_SIZE);
+
+    ASSERT(pm_fill_zeroed_pool());
+    paddr = pm_alloc(PAGE_SIZE, NULL, PM_ALLOC_ZEROED);
+    ASSERT(paddr != 0 && zeroed_pool_hits == hits + 1);
+    ASSERT(is_zeroed_page(paddr));
+    pm_free(paddr, PAGE_SIZE);
+
+    // 統計情報に自己テストの分を含めない
+    zeroed_pool_hits = hits;
+    zeroed_pool_misses = misses;
+    TRACE("pm: zeroed page pool OK");
+}
+
+// 物理メモリ管理の自己テスト。起動時に呼ばれる。
+void pm_selftest(void) {
+    struct memory_zone *zone =
+        LIST_CONTAINER(zones.next, struct memory_zone, next);
+    ASSERT(zone->type == MEMORY_ZONE_FREE);
+
+    test_buddy(zone);
+    test_page_cache();
+    test_page_lookup();
+    test_zeroed_pool();
+}
+
+// デバッグ用にメモリ管理の統計情報を表示する。
+void pm_dump(void) {
+    spin_lock(&pm_lock);
+    unsigned hits = zeroed_pool_hits;
+    unsigned misses = zeroed_pool_misses;
+    unsigned count = zeroed_pool_count;
+    spin_unlock(&pm_lock);
+
+    WARN("zeroed page pool: %u hits, %u misses (%u pages in pool)", hits,
+         misses, count);
+}
+
 // メモリ管理システムの初期化
 void memory_init(struct bootinfo *bootinfo) {
     struct memory_map *memory_map = &bootinfo->memory_map;
@@ -274,8 +813,12 @@ void memory_init(struct bootinfo *bootinfo) {
 
         struct memory_zone *zone =
             (struct memory_zone *) arch_paddr_to_vaddr(e->paddr);
+        // 領域の先頭にゾーン管理構造体を置き、残りを物理ページとして使う。管理構造体を
+        // ページ境界に切り上げる分として、1ページ余分に差し引いておく。
         size_t num_pages =
-            ALIGN_DOWN(e->size, PAGE_SIZE) / (PAGE_SIZE + sizeof(struct page));
+            (ALIGN_DOWN(e->size, PAGE_SIZE) - sizeof(struct memory_zone)
+             - PAGE_SIZE)
+            / (PAGE_SIZE + sizeof(struct page));
 
         void *end_of_header = &zone->pages[num_pages + 1];
         size_t header_size = ((vaddr_t) end_of_header) - ((vaddr_t) zone);
@@ -2,15 +2,26 @@
 #include <libs/common/list.h>
 #include <libs/common/types.h>
 
+// バディアロケータで扱う最大のオーダー。オーダーnのブロックは2^n個の連続した物理ページ
+// からなる (オーダー15で128MiB)。
+#define PM_ORDER_MAX 15
+// 空きブロックの先頭ページではないことを表すオーダー
+#define PM_ORDER_NONE -1
+
 // 物理ページ管理構造体
 struct page {
-    struct task *owner;  // 所有者 (NULLならカーネルの内部データ構造)
-    unsigned ref_count;  // 参照カウンタ:
-                         // - 0: 空き
-                         // - 1: 割り当て済み (まだマップされていない)
-                         // - 2: マップ済み (1つのタスクでのみ使用中)
-                         // - 3以上: マップ済み (複数のタスクで使用中。つまり共有メモリ)
-    list_elem_t next;    // 所有者タスクのtask->pagesのリスト要素
+    struct task *owner;        // 所有者 (NULLならカーネルの内部データ構造)
+    unsigned ref_count;        // 参照カウンタ: 所有者の分 (割り当て済みなら1) と、
+                               // マップされている数の合計。0になると解放される。
+                               // - 0: 空き
+                               // - 1: 割り当て済み (どこにもマップされていない)
+                               // - 2: マップ済み (1箇所にのみマップされている)
+                               // - 3以上: マップ済み (複数箇所。つまり共有メモリ)
+    int order;                 // 空きブロックの先頭ページであればそのオーダー
+                               // (それ以外はPM_ORDER_NONE)
+    struct memory_zone *zone;  // このページを含むゾーン
+    list_elem_t next;          // 所有者タスクのtask->pagesのリスト要素
+                               // (空きブロックの先頭ページの場合は空きリストの要素)
 };
 
 // メモリゾーンの種類
@@ -21,11 +32,12 @@ enum memory_zone_type {
 
 // メモリゾーン管理構造体
 struct memory_zone {
-    enum memory_zone_type type;  // 種類
-    list_elem_t next;            // 各メモリゾーンを繋げたリストの要素
-    paddr_t base;                // 先頭物理アドレス
-    size_t num_pages;            // 物理ページ数
-    struct page pages[];         // 物理ページ管理構造体の配列
+    enum memory_zone_type type;           // 種類
+    list_elem_t next;                     // 各メモリゾーンを繋げたリストの要素
+    paddr_t base;                         // 先頭物理アドレス
+    size_t num_pages;                     // 物理ページ数
+    list_t free_lists[PM_ORDER_MAX + 1];  // オーダーごとの空きブロックのリスト
+    struct page pages[];                  // 物理ページ管理構造体の配列
 };
 
 struct task;
@@ -33,8 +45,13 @@ paddr_t pm_alloc(size_t size, struct task *owner, unsigned flags);
 void pm_own_page(paddr_t paddr, struct task *owner);
 void pm_free(paddr_t paddr, size_t size);
 void pm_free_by_list(list_t *pages);
+bool pm_fill_zeroed_pool(void);
+void pm_selftest(void);
+void pm_dump(void);
 error_t vm_map(struct task *task, uaddr_t uaddr, paddr_t paddr, unsigned attrs);
 error_t vm_unmap(struct task *task, uaddr_t uaddr);
+error_t vm_move_pages(struct task *src, uaddr_t src_uaddr, struct task *dst,
+                      uaddr_t dst_uaddr, size_t num_pages);
 void handle_page_fault(uaddr_t uaddr, vaddr_t ip, unsigned fault);
 
 struct bootinfo;
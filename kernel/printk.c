@@ -1,5 +1,6 @@
 #include "printk.h"
 #include "arch.h"
+#include "spinlock.h"
 #include "task.h"
 #include <libs/common/list.h>
 #include <libs/common/string.h>
@@ -7,6 +8,8 @@
 
 // UARTからのデータを待っているタスクのリスト
 static list_t serial_readers = LIST_INIT(serial_readers);
+// UARTへの出力を保護するロック。カーネルロックを持っていなくても出力できるようにする。
+static struct spinlock serial_lock = SPINLOCK_INIT("serial");
 // UARTからの入力データのリングバッファと、その読み書き位置
 static char input[128];
 static int input_rp = 0;
@@ -71,15 +74,38 @@ int serial_read(char *buf, int max_len) {
     return len;
 }
 
-// カーネル内部でのみ使用するputchar実装。UARTに出力する。
+// UARTに文字列を出力する。カーネルロックを持っていなくても呼び出せる。
+void serial_write(const char *buf, int len) {
+    spin_lock(&serial_lock);
+    for (int i = 0; i < len; i++) {
+        arch_serial_write(buf[i]);
+    }
+    spin_unlock(&serial_lock);
+}
+
+// カーネル内部でのみ使用するputchar実装。UARTに出力する。呼び出し元のprintf関数が
+// serial_lockを持っている。
 void printchar(char ch) {
     arch_serial_write(ch);
 }
 
 // カーネル内部でのみ使用するprintf実装。UARTに出力する。
+//
+// 出力し終わるまでserial_lockを持ち続けるので、ログメッセージの1行の途中に他のCPUの出力が
+// 割り込むことはない。
 void printf(const char *fmt, ...) {
+    // 出力中にパニックした場合など、同じCPUで再び呼ばれた場合はロックを取らずに出力する
+    bool locked = serial_lock.owner != CPUVAR->id;
+    if (locked) {
+        spin_lock(&serial_lock);
+    }
+
     va_list vargs;
     va_start(vargs, fmt);
     vprintf(fmt, vargs);
     va_end(vargs);
+
+    if (locked) {
+        spin_unlock(&serial_lock);
+    }
 }
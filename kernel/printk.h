@@ -3,3 +3,4 @@
 
 void handle_serial_interrupt(void);
 int serial_read(char *buf, int max_len);
+void serial_write(const char *buf, int len);
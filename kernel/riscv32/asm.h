@@ -9,6 +9,9 @@
 // mieレジスタのフィールド
 #define MIE_MTIE (1 << 7)  // M-mode timer interrupt-enable bit
 
+// mcounterenレジスタのフィールド
+#define MCOUNTEREN_CY (1 << 0)  // S-modeからcycleレジスタを読めるようにする
+
 // sstausレジスタのフィールド
 #define SSTATUS_SIE  (1 << 1)   // interrupt-enable bits
 #define SSTATUS_SPIE (1 << 5)   // interrupt-enable bit active prior to the trap
@@ -55,12 +58,28 @@
     ((volatile uint64_t *) arch_paddr_to_vaddr(CPUVAR->arch.mtimecmp))
 #define MTIME ((volatile uint64_t *) arch_paddr_to_vaddr(CPUVAR->arch.mtime))
 
+// mtimeレジスタの値を読み込む。32ビットCPUでは上位・下位32ビットを別々に読むので、その間に
+// 下位32ビットが桁あふれすると上位32ビットと食い違った値になる。上位32ビットが変わらない
+// まで読み直す。
+static inline uint64_t arch_read_mtime(void) {
+    volatile uint32_t *mtime = (volatile uint32_t *) MTIME;
+    uint32_t hi, lo;
+    do {
+        hi = mtime[1];
+        lo = mtime[0];
+    } while (mtime[1] != hi);
+
+    return ((uint64_t) hi << 32) | lo;
+}
+
 // 1ミリ秒ごとにmtimeレジスタの値がどれだけ進むか。QEMUのタイマーからとった値。
 #define MTIME_PER_1MS 10000
 
+// 1 tickごとにmtimeレジスタの値がどれだけ進むか。
+#define MTIME_PER_TICK (MTIME_PER_1MS / (TICK_HZ / 1000))
+
 // mtimeレジスタの値の差からticksに変換するマクロ。
-#define MTIME_TO_TICKS(mtime_diff)                                             \
-    (((unsigned) (mtime_diff)) / (MTIME_PER_1MS / (TICK_HZ / 1000)))
+#define MTIME_TO_TICKS(mtime_diff) (((unsigned) (mtime_diff)) / MTIME_PER_TICK)
 
 // Advanced Core Local Interruptor (ACLINT) のメモリマップトレジスタ
 #define ACLINT_SSWI_PADDR 0x2f00000
@@ -108,6 +127,18 @@ static inline void write_mtvec(uint32_t value) {
     __asm__ __volatile__("csrw mtvec, %0" ::"r"(value));
 }
 
+// mcounterenレジスタへの書き込み関数
+static inline void write_mcounteren(uint32_t value) {
+    __asm__ __volatile__("csrw mcounteren, %0" ::"r"(value));
+}
+
+// cycleレジスタ (CPUのサイクル数の下位32ビット) からの読み込み関数
+static inline uint32_t read_cycle(void) {
+    uint32_t value;
+    __asm__ __volatile__("rdcycle %0" : "=r"(value));
+    return value;
+}
+
 // mscratchレジスタへの書き込み関数
 static inline void write_mscratch(uint32_t value) {
     __asm__ __volatile__("csrw mscratch, %0" ::"r"(value));
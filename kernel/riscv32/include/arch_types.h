@@ -29,8 +29,7 @@ struct arch_cpuvar {
     uint32_t mscratch1;   // 変数の一時保管場所その2
     paddr_t mtimecmp;     // MTIMECMPのアドレス
     paddr_t mtime;        // MTIMEのアドレス
-    uint32_t interval;    // MTIMECMPに加算していく値
-    uint64_t last_mtime;  // 直前のmtimeの値
+    uint64_t last_mtime;  // 直前のタイマー割り込み処理時のmtimeの値
 };
 
 // CPUVAR_* マクロが正しく定義されているかをチェックするためのマクロ。
@@ -46,9 +45,7 @@ struct arch_cpuvar {
     STATIC_ASSERT(offsetof(struct cpuvar, arch.mtimecmp) == CPUVAR_MTIMECMP,   \
                   "CPUVAR_MTIMECMP is incorrect");                             \
     STATIC_ASSERT(offsetof(struct cpuvar, arch.mtime) == CPUVAR_MTIME,         \
-                  "CPUVAR_MTIME is incorrect");                                \
-    STATIC_ASSERT(offsetof(struct cpuvar, arch.interval) == CPUVAR_INTERVAL,   \
-                  "CPUVAR_INTERVAL is incorrect");
+                  "CPUVAR_MTIME is incorrect");
 
 // CPUVARマクロの中身。現在のCPUローカル変数のアドレスを返す。
 static inline struct cpuvar *arch_cpuvar_get(void) {
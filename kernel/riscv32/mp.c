@@ -2,11 +2,14 @@
 #include "asm.h"
 #include <kernel/arch.h>
 #include <kernel/printk.h>
+#include <kernel/spinlock.h>
 #include <kernel/task.h>
 
 static struct cpuvar cpuvars[NUM_CPUS_MAX];
-static uint32_t big_lock = BKL_UNLOCKED;
-static int locked_cpu = -1;
+// カーネルロック。チケットロックなので、取得しようとした順番にCPUがカーネルに入れる。
+static struct spinlock big_lock = SPINLOCK_INIT("kernel");
+// システムが停止した状態 (ロックを取らず停止する) かどうか
+static bool halted = false;
 
 // setssipレジスタ (ACLINT) への書き込みをしてIPIを発行する。
 static void write_setssip(uint32_t hartid) {
@@ -14,54 +17,66 @@ static void write_setssip(uint32_t hartid) {
     mmio_write32_paddr(ACLINT_SSWI_SETSSIP(hartid), 1);
 }
 
-// カーネルロック取得前に満たしておくべき条件をチェックする
-static void check_lock(void) {
-    DEBUG_ASSERT((read_sstatus() & SSTATUS_SIE) == 0);
-
-    if (big_lock == BKL_HALTED) {
-        // 他のCPUが停止状態に入っている。そのCPUがパニックメッセージを出力するために
-        // 無理矢理カーネルロックを奪っているため、処理を進めるとまずい。
+// 他のCPUが停止状態に入っていれば、このCPUも停止する。そのCPUがパニックメッセージを出力
+// するために無理矢理カーネルロックを奪っているため、処理を進めるとまずい。
+static void stop_if_halted(void) {
+    if (atomic_load(&halted)) {
         for (;;) {
             asm_wfi();
         }
     }
 }
 
+// カーネルロック取得前に満たしておくべき条件をチェックする
+static void check_lock(void) {
+    DEBUG_ASSERT((read_sstatus() & SSTATUS_SIE) == 0);
+    stop_if_halted();
+}
+
 // カーネルロックを取得する
 void mp_lock(void) {
     check_lock();  // ロックの状態をチェック (デバッグ用)
+    spin_lock(&big_lock);
 
-    // 書き込み成功するまで試行し続ける
-    while (true) {
-        if (compare_and_swap(&big_lock, BKL_UNLOCKED, BKL_LOCKED)) {
-            break;
-        }
-    }
-
-    locked_cpu = CPUVAR->id;  // カーネルロックを持っているCPUのIDを記録
-
-    // ここ以降のメモリ読み書きが上のロック取得前に行われないようにする (メモリバリア)。
-    // これがないとCPUやコンパイラが並び替えてしまう恐れがある。
-    full_memory_barrier();
+    // ロックを待っている間に停止状態に入った
+    stop_if_halted();
 }
 
 // カーネルロックを解放する
 void mp_unlock(void) {
-    DEBUG_ASSERT(CPUVAR->id == locked_cpu);
+    // 停止状態ではロックを奪われているので、解放せずに停止する。解放すると順番待ちしている
+    // CPUがカーネルに入ってきてしまう。
+    stop_if_halted();
+    spin_unlock(&big_lock);
+}
 
-    // ここ以前のメモリ読み書きが上のロック解放前に行われるようにする (メモリバリア)。
-    // これがないとCPUやコンパイラが並び替えてしまう恐れがある。
-    full_memory_barrier();
+// カーネルロックを取得する。アーキテクチャ非依存のコードから使う。
+void arch_lock(void) {
+    mp_lock();
+}
 
-    // ロックを解放
-    compare_and_swap(&big_lock, BKL_LOCKED, BKL_UNLOCKED);
+// カーネルロックを解放する。アーキテクチャ非依存のコードから使う。
+void arch_unlock(void) {
+    mp_unlock();
 }
 
 // カーネルロックを強制的に取得する。カーネルパニックなど致命的なエラーが発生したときに
 // 他のCPUからロックを奪い取ってカーネルを停止するために使う。
+//
+// チケットロックは持ち主を書き換えても他のCPUを止められないので、先に停止状態に入る。
+// 他のCPUはカーネルロックの取得・解放の時点で停止する。ユーザーモードで実行中のCPUも
+// IPIでカーネルに入らせて停止させる。
 void mp_force_lock(void) {
-    big_lock = BKL_LOCKED;
-    locked_cpu = CPUVAR->id;
+    halted = true;
+    full_memory_barrier();
+
+    for (int hartid = 0; hartid < NUM_CPUS_MAX; hartid++) {
+        if (cpuvars[hartid].online && hartid != CPUVAR->id) {
+            write_setssip(hartid);
+        }
+    }
+
+    big_lock.owner = CPUVAR->id;
     full_memory_barrier();
 }
 
@@ -71,7 +86,34 @@ struct cpuvar *riscv32_cpuvar_of(int hartid) {
     return &cpuvars[hartid];
 }
 
-// 他のCPUにプロセッサ間割り込み (IPI) を送信する
+// 指定したCPUのCPUローカル変数を取得する。アーキテクチャ非依存のコードから使う。
+struct cpuvar *arch_cpuvar_of(int id) {
+    return riscv32_cpuvar_of(id);
+}
+
+// 指定したCPUにIPIを送信する
+static void send_ipi(struct cpuvar *cpuvar, unsigned ipi) {
+    // IPIの送信理由を宛先CPUのローカル変数に記録する (アトミックな |= 演算)
+    atomic_fetch_and_or(&cpuvar->ipi_pending, ipi);
+
+    // IPIを送信する
+    write_setssip(cpuvar->id);
+}
+
+// 他のCPUから要求されたTLBのクリア (TLB shootdown) を処理する。TLB shootdownは要求元が
+// カーネルロックを持ったまま完了を待つので、割り込みを受け付けられない状態でロックの解放を
+// 待っている間もこの関数を呼んで処理する必要がある。
+void arch_handle_tlb_flush(void) {
+    if (atomic_load(&CPUVAR->ipi_pending) & IPI_TLB_FLUSH) {
+        atomic_fetch_and_and(&CPUVAR->ipi_pending, ~IPI_TLB_FLUSH);
+        asm_sfence_vma();
+    }
+}
+
+// 他のCPUにプロセッサ間割り込み (IPI) を送信する。
+//
+// TLB shootdown (IPI_TLB_FLUSH) のみの場合は、カーネルロックを持ったまま完了を待つ。
+// そのため、呼び出し元はTLB shootdownの前後でタスクの状態が変わることを気にしなくてよい。
 void arch_send_ipi(unsigned ipi) {
     // 自身を除いた全CPUにIPIを送信する
     for (int hartid = 0; hartid < NUM_CPUS_MAX; hartid++) {
@@ -79,33 +121,49 @@ void arch_send_ipi(unsigned ipi) {
 
         // 起動が完了しているCPUかつ自身以外かチェック
         if (cpuvar->online && hartid != CPUVAR->id) {
-            // IPIの送信理由を宛先CPUのローカル変数に記録する (アトミックな |= 演算)
-            atomic_fetch_and_or(&cpuvar->ipi_pending, ipi);
-
-            // IPIを送信する
-            write_setssip(hartid);
+            send_ipi(cpuvar, ipi);
         }
     }
 
     // 各CPUがIPIを処理するまで待つ
     for (int hartid = 0; hartid < NUM_CPUS_MAX; hartid++) {
         struct cpuvar *cpuvar = riscv32_cpuvar_of(hartid);
-        if (cpuvar->online && hartid != CPUVAR->id) {
-            // 一旦カーネルロックを解放して他のCPUがカーネルに入れるようにする
-            mp_unlock();
+        if (!cpuvar->online || hartid == CPUVAR->id) {
+            continue;
+        }
 
-            // CPUがIPIを処理するまで待つ
-            unsigned pending;
-            do {
-                pending = atomic_load(&cpuvar->ipi_pending);
-            } while (pending != 0);
+        if ((ipi & ~IPI_TLB_FLUSH) == 0) {
+            // TLBのクリアは宛先CPUがカーネルロックを待っている間にも処理されるので、
+            // ロックを持ったまま待てる
+            while (atomic_load(&cpuvar->ipi_pending) & IPI_TLB_FLUSH) {
+                ;
+            }
 
-            // カーネルロックを再取得
-            mp_lock();
+            continue;
         }
+
+        // 一旦カーネルロックを解放して他のCPUがカーネルに入れるようにする
+        mp_unlock();
+
+        // CPUがIPIを処理するまで待つ。その間に他のCPUから要求されたTLB shootdownも処理する。
+        unsigned pending;
+        do {
+            arch_handle_tlb_flush();
+            pending = atomic_load(&cpuvar->ipi_pending);
+        } while (pending != 0);
+
+        // カーネルロックを再取得
+        mp_lock();
     }
 }
 
+// 指定したCPUにIPIを送信する。arch_send_ipiと異なり、宛先CPUがIPIを処理するのは待たない。
+void arch_send_ipi_to(int id, unsigned ipi) {
+    struct cpuvar *cpuvar = riscv32_cpuvar_of(id);
+    DEBUG_ASSERT(cpuvar->online && id != CPUVAR->id);
+    send_ipi(cpuvar, ipi);
+}
+
 // 各CPUの初期化処理
 void riscv32_mp_init_percpu(void) {
     CPUVAR->online = true;
@@ -113,7 +171,7 @@ void riscv32_mp_init_percpu(void) {
 
 // コンピュータを停止する
 __noreturn void halt(void) {
-    big_lock = BKL_HALTED;
+    halted = true;
     full_memory_barrier();
 
     WARN("kernel halted (CPU #%d)", CPUVAR->id);
@@ -107,9 +107,9 @@ __noreturn void riscv32_boot(void) {
     memset(cpuvar, 0, sizeof(struct cpuvar));
     cpuvar->magic = CPUVAR_MAGIC;
     cpuvar->online = false;  // まだブート中
+    cpuvar->idle = false;
     cpuvar->id = hartid;
     cpuvar->ipi_pending = 0;
-    cpuvar->arch.interval = MTIME_PER_1MS;
     cpuvar->arch.mtimecmp = CLINT_MTIMECMP(hartid);
     cpuvar->arch.mtime = CLINT_MTIME;
 
@@ -136,6 +136,9 @@ __noreturn void riscv32_boot(void) {
     write_mstatus(read_mstatus() | MSTATUS_MIE);
     write_mie(read_mie() | MIE_MTIE);
 
+    // ロックの統計情報を取るために、S-modeからcycleレジスタを読めるようにする。
+    write_mcounteren(MCOUNTEREN_CY);
+
     // mret命令で飛ぶ先のアドレスを設定する。
     if (hartid == 0) {
         write_mepc((uint32_t) riscv32_setup);
@@ -179,9 +182,8 @@ void arch_init_percpu(void) {
     riscv32_mp_init_percpu();
 
     // タイマー割り込みを設定する。
-    uint32_t last_mtime = *MTIME;
-    *MTIMECMP = last_mtime + CPUVAR->arch.interval;
-    CPUVAR->arch.last_mtime = last_mtime;
+    CPUVAR->arch.last_mtime = arch_read_mtime();
+    arch_set_timer(1);
 
     if (CPUVAR->id == 0) {
         hart0_ready = true;
@@ -189,8 +191,42 @@ void arch_init_percpu(void) {
     }
 }
 
+// 起動してからの経過時間 (ticks) を返す。mtimeレジスタの値をそのまま割るには64ビットの
+// 除算が必要になるので、前回からの差分を足していく。そのため、少なくとも約7分 (mtimeの
+// 差分が32ビットに収まる間) に1回は呼び出す必要がある。
+unsigned arch_uptime_ticks(void) {
+    static uint64_t base_mtime = 0;
+    static unsigned base_ticks = 0;
+
+    unsigned ticks = MTIME_TO_TICKS(arch_read_mtime() - base_mtime);
+    base_mtime += ticks * MTIME_PER_TICK;
+    base_ticks += ticks;
+    return base_ticks;
+}
+
+// CPUのサイクル数 (下位32ビット) を返す。時間の差を計測するのに使う。
+uint32_t arch_read_cycles(void) {
+    return read_cycle();
+}
+
+// 指定した時間 (ticks) が経過した後にタイマー割り込みが発生するように設定する (ワンショット
+// タイマー)。0の場合はすぐに発生する。
+void arch_set_timer(unsigned ticks) {
+    uint64_t deadline = arch_read_mtime() + ticks * MTIME_PER_TICK;
+
+    // 64ビットのmtimecmpレジスタを32ビットずつ書き込むので、書き込んでいる途中の値で割り込みが
+    // 発生しないように、まず下位32ビットを最大値にしておく。
+    volatile uint32_t *mtimecmp = (volatile uint32_t *) MTIMECMP;
+    mtimecmp[0] = 0xffffffff;
+    mtimecmp[1] = deadline >> 32;
+    mtimecmp[0] = deadline;
+}
+
 // アイドルタスクのメイン処理。割り込みが来るまでCPUを休ませる。
 void arch_idle(void) {
+    // 他のCPUがタスクをこのCPUのランキューに入れたときに、IPIで起こしてもらう
+    CPUVAR->idle = true;
+
     // 割り込みハンドラが自身でカーネルロックをとっているので、ここではロックを解除する
     mp_unlock();
 
@@ -202,6 +238,7 @@ void arch_idle(void) {
     // 割り込みを無効化してカーネルロックを取り直す。
     write_sstatus(read_sstatus() & ~SSTATUS_SIE);
     mp_lock();
+    CPUVAR->idle = false;
 }
 
 __noreturn void arch_shutdown(void) {
@@ -8,8 +8,9 @@
 #include <kernel/printk.h>
 #include <kernel/task.h>
 
-// ユーザータスクへの最初のコンテキストスイッチ時に呼び出される関数
-__noreturn void riscv32_user_entry(uint32_t ip) {
+// ユーザータスクへの最初のコンテキストスイッチ時に呼び出される関数。spはユーザースタック
+// の初期値、argはa0レジスタ (第1引数) に渡される値で、スレッドの場合にのみ使われる。
+__noreturn void riscv32_user_entry(uint32_t ip, uint32_t sp, uint32_t arg) {
     mp_unlock();     // ユーザーモードへ入るのでカーネルロックを解放する
     write_sepc(ip);  // ユーザータスクの実行開始アドレスを設定
 
@@ -19,17 +20,19 @@ __noreturn void riscv32_user_entry(uint32_t ip) {
     sstatus |= SSTATUS_SPIE;
     write_sstatus(sstatus);
 
-    // カーネルの情報を漏らさないようにレジスタをクリアしてからユーザーモードに移行する
+    // カーネルの情報を漏らさないようにレジスタをクリアしてからユーザーモードに移行する。
+    // スタックポインタ (x2) と第1引数 (x10) のみ指定された値を設定する。
+    register uint32_t a0 __asm__("a0") = arg;
+    register uint32_t a1 __asm__("a1") = sp;
     __asm__ __volatile__(
         "mv x1, zero\n\t"
-        "mv x2, zero\n\t"
+        "mv x2, a1\n\t"
         "mv x3, zero\n\t"
         "mv x4, zero\n\t"
         "mv x5, zero\n\t"
         "mv x6, zero\n\t"
         "mv x7, zero\n\t"
         "mv x8, zero\n\t"
-        "mv x10, zero\n\t"
         "mv x11, zero\n\t"
         "mv x12, zero\n\t"
         "mv x13, zero\n\t"
@@ -51,7 +54,7 @@ __noreturn void riscv32_user_entry(uint32_t ip) {
         "mv x29, zero\n\t"
         "mv x30, zero\n\t"
         "mv x31, zero\n\t"
-        "sret");
+        "sret" ::"r"(a0), "r"(a1));
 
     // この関数には決して戻ってこない。ユーザータスクからカーネルモードに戻るときは常に
     // riscv32_trap_handler が入り口となる。
@@ -80,8 +83,8 @@ void arch_task_switch(struct task *prev, struct task *next) {
 }
 
 // タスクを初期化する
-error_t arch_task_init(struct task *task, uaddr_t ip, vaddr_t kernel_entry,
-                       void *arg) {
+error_t arch_task_init(struct task *task, uaddr_t ip, uaddr_t sp,
+                       vaddr_t kernel_entry, void *arg) {
     // カーネルスタックを割り当てる。スタックカナリー (stack canary) のアドレスを常に
     // stack_bottom 関数で計算できるように、 PM_ALLOC_ALIGNED フラグを指定して
     // スタックサイズの倍数のアドレスになるように割り当てる。
@@ -93,37 +96,39 @@ error_t arch_task_init(struct task *task, uaddr_t ip, vaddr_t kernel_entry,
 
     // カーネルスタックを用意する。スタックはアドレスの下方向に伸びることに注意。
     uint32_t sp_top = sp_bottom + KERNEL_STACK_SIZE;
-    uint32_t *sp = (uint32_t *) arch_paddr_to_vaddr(sp_top);
+    uint32_t *ksp = (uint32_t *) arch_paddr_to_vaddr(sp_top);
 
     uint32_t entry;
     if (kernel_entry) {
         // riscv32_kernel_entry_trampoline関数でポップされる値
-        *--sp = (uint32_t) kernel_entry;  // タスクの実行開始アドレス
-        *--sp = (uint32_t) arg;           // a0レジスタ (第1引数) に渡される値
+        *--ksp = (uint32_t) kernel_entry;  // タスクの実行開始アドレス
+        *--ksp = (uint32_t) arg;           // a0レジスタ (第1引数) に渡される値
         entry = (uint32_t) riscv32_kernel_entry_trampoline;
     } else {
         // riscv32_user_entry_trampoline関数でポップされる値
-        *--sp = ip;  // タスクの実行開始アドレス
+        *--ksp = (uint32_t) arg;  // a0レジスタ (第1引数) に渡される値
+        *--ksp = sp;              // ユーザースタックの初期値
+        *--ksp = ip;              // タスクの実行開始アドレス
         entry = (uint32_t) riscv32_user_entry_trampoline;
     }
 
     // riscv32_task_switch関数で復元される実行コンテキスト
-    *--sp = 0;      // s11
-    *--sp = 0;      // s10
-    *--sp = 0;      // s9
-    *--sp = 0;      // s8
-    *--sp = 0;      // s7
-    *--sp = 0;      // s6
-    *--sp = 0;      // s5
-    *--sp = 0;      // s4
-    *--sp = 0;      // s3
-    *--sp = 0;      // s2
-    *--sp = 0;      // s1
-    *--sp = 0;      // s0
-    *--sp = entry;  // ra
+    *--ksp = 0;      // s11
+    *--ksp = 0;      // s10
+    *--ksp = 0;      // s9
+    *--ksp = 0;      // s8
+    *--ksp = 0;      // s7
+    *--ksp = 0;      // s6
+    *--ksp = 0;      // s5
+    *--ksp = 0;      // s4
+    *--ksp = 0;      // s3
+    *--ksp = 0;      // s2
+    *--ksp = 0;      // s1
+    *--ksp = 0;      // s0
+    *--ksp = entry;  // ra
 
     // タスク管理構造体を埋める
-    task->arch.sp = (uint32_t) sp;
+    task->arch.sp = (uint32_t) ksp;
     task->arch.sp_bottom = sp_bottom;
     task->arch.sp_top = (uint32_t) sp_top;
 
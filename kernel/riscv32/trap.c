@@ -46,13 +46,12 @@ static void handle_soft_interrupt_trap(void) {
         }
     }
 
-    // タイマーが進んでいたら、タイマー割り込みハンドラを呼び出す
-    unsigned now = *MTIME;
-    unsigned ticks = MTIME_TO_TICKS(now - CPUVAR->arch.last_mtime);
-    CPUVAR->arch.last_mtime = now;
-    if (ticks > 0) {
-        handle_timer_interrupt(ticks);
-    }
+    // タイマー割り込みハンドラを呼び出す。ワンショットタイマーを設定し直す必要があるので、
+    // タイマーが進んでいなくても (IPIの場合も) 呼び出す。
+    unsigned ticks =
+        MTIME_TO_TICKS(arch_read_mtime() - CPUVAR->arch.last_mtime);
+    CPUVAR->arch.last_mtime += ticks * MTIME_PER_TICK;
+    handle_timer_interrupt(ticks);
 }
 
 // ハードウェア割り込み
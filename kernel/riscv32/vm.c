@@ -88,8 +88,9 @@ error_t arch_vm_map(struct arch_vm *vm, vaddr_t vaddr, paddr_t paddr,
     return OK;
 }
 
-// ページをアンマップする。
-error_t arch_vm_unmap(struct arch_vm *vm, vaddr_t vaddr) {
+// ページをアンマップする。アンマップしたページの物理アドレスをpaddrに返す。ページの解放は
+// 行わない。
+error_t arch_vm_unmap(struct arch_vm *vm, vaddr_t vaddr, paddr_t *paddr) {
     // ページテーブルエントリを探す
     pte_t *pte;
     error_t err = walk(vm->table, vaddr, false, &pte);
@@ -102,10 +103,8 @@ error_t arch_vm_unmap(struct arch_vm *vm, vaddr_t vaddr) {
         return ERR_NOT_FOUND;
     }
 
-    // ページを解放する
-    paddr_t paddr = PTE_PADDR(*pte);
+    *paddr = PTE_PADDR(*pte);
     *pte = 0;
-    pm_free(paddr, PAGE_SIZE);
 
     // TLBをクリアする
     asm_sfence_vma();
@@ -115,6 +114,66 @@ error_t arch_vm_unmap(struct arch_vm *vm, vaddr_t vaddr) {
     return OK;
 }
 
+// 仮想アドレスにマップされている物理アドレスを取得する。
+error_t arch_vm_lookup(struct arch_vm *vm, vaddr_t vaddr, paddr_t *paddr) {
+    // ページテーブルエントリを探す
+    pte_t *pte;
+    error_t err = walk(vm->table, vaddr, false, &pte);
+    if (err != OK) {
+        return err;
+    }
+
+    // ページがマップされていなかったら中断する
+    if (!pte || (*pte & PTE_V) == 0) {
+        return ERR_NOT_FOUND;
+    }
+
+    *paddr = PTE_PADDR(*pte);
+    return OK;
+}
+
+// srcのsrc_vaddrにマップされているページを、dstのdst_vaddrへ読み書き可能なページとして
+// 付け替える。移動したページの物理アドレスをpaddrに返す。移動先に既にページがマップされて
+// いた場合は、その物理アドレスをreplacedに返す (なければ0)。ページの解放は行わない。
+//
+// TLBのクリアは実行中のCPUでしか行わないため、srcとdstのどちらも他のCPUで使われていない
+// (タスク切り替え時にTLBがクリアされる) ことが前提。
+error_t arch_vm_move(struct arch_vm *src, vaddr_t src_vaddr,
+                     struct arch_vm *dst, vaddr_t dst_vaddr, paddr_t *paddr,
+                     paddr_t *replaced) {
+    DEBUG_ASSERT(IS_ALIGNED(src_vaddr, PAGE_SIZE));
+    DEBUG_ASSERT(IS_ALIGNED(dst_vaddr, PAGE_SIZE));
+
+    // 移動元のページテーブルエントリを探す
+    pte_t *src_pte;
+    error_t err = walk(src->table, src_vaddr, false, &src_pte);
+    if (err != OK) {
+        return err;
+    }
+
+    if (!src_pte || (*src_pte & PTE_V) == 0) {
+        return ERR_NOT_FOUND;
+    }
+
+    // 移動先のページテーブルエントリを探す。移動元を変更する前に行うことで、ページテーブル
+    // の割り当てに失敗した場合にページが失われないようにする。
+    pte_t *dst_pte;
+    err = walk(dst->table, dst_vaddr, true, &dst_pte);
+    if (err != OK) {
+        return err;
+    }
+
+    // ページテーブルエントリを付け替える
+    *paddr = PTE_PADDR(*src_pte);
+    *replaced = (*dst_pte & PTE_V) ? PTE_PADDR(*dst_pte) : 0;
+    *dst_pte = construct_pte(*paddr, PTE_R | PTE_W | PTE_U | PTE_V);
+    *src_pte = 0;
+
+    // TLBをクリアする
+    asm_sfence_vma();
+    return OK;
+}
+
 // 仮想アドレスがページテーブルにマップされているかどうかを返す。
 bool riscv32_is_mapped(uint32_t satp, vaddr_t vaddr) {
     satp = (satp & SATP_PPN_MASK) << SATP_PPN_SHIFT;
@@ -0,0 +1,214 @@
+#include "slab.h"
+#include "memory.h"
+#include "printk.h"
+#include <libs/common/string.h>
+
+// スラブの管理構造体。スラブの先頭に置かれ、その後ろにオブジェクトが並ぶ。
+struct slab {
+    list_elem_t next;          // cache->partial_slabsのリストの要素
+    struct slab_cache *cache;  // スラブを所有するキャッシュ
+    paddr_t paddr;             // スラブの物理アドレス
+    unsigned num_free;         // 空きオブジェクトの数
+    void *free_objects;        // 空きオブジェクトの単方向リスト
+};
+
+// スラブ内の最初のオブジェクトのオフセット
+#define SLAB_HEADER_SIZE ALIGN_UP(sizeof(struct slab), 8)
+// 自己テストで割り当てるオブジェクトの数
+#define SLAB_SELFTEST_OBJECTS 64
+
+// 一度でも使われたキャッシュの一覧 (統計情報の表示用)
+static struct slab_cache *all_caches = NULL;
+
+// キャッシュのスラブのサイズなどを決める。最初の割り当て時に呼ばれる。
+static void init_cache(struct slab_cache *cache) {
+    // 空きオブジェクトには次の空きオブジェクトへのポインタを埋め込む
+    size_t object_size = ALIGN_UP(MAX(cache->object_size, sizeof(void *)), 8);
+    size_t slab_size = PAGE_SIZE;
+    while ((slab_size - SLAB_HEADER_SIZE) / object_size < SLAB_OBJECTS_MIN) {
+        slab_size *= 2;
+    }
+
+    cache->object_size = object_size;
+    cache->slab_size = slab_size;
+    cache->objects_per_slab = (slab_size - SLAB_HEADER_SIZE) / object_size;
+    list_init(&cache->partial_slabs);
+    cache->next_cache = all_caches;
+    all_caches = cache;
+}
+
+// オブジェクトを含むスラブを返す。スラブはそのサイズでアラインされている。
+static struct slab *slab_of(struct slab_cache *cache, void *obj) {
+    return (struct slab *) ALIGN_DOWN((vaddr_t) obj, cache->slab_size);
+}
+
+// 新しいスラブを割り当て、空きオブジェクトのリストを作る。
+static error_t grow_cache(struct slab_cache *cache) {
+    paddr_t paddr = pm_alloc(cache->slab_size, NULL, PM_ALLOC_ALIGNED);
+    if (!paddr) {
+        return ERR_NO_MEMORY;
+    }
+
+    struct slab *slab = (struct slab *) arch_paddr_to_vaddr(paddr);
+    slab->cache = cache;
+    slab->paddr = paddr;
+    slab->num_free = cache->objects_per_slab;
+    slab->free_objects = NULL;
+
+    // 先頭のオブジェクトから順に割り当てられるように、末尾から空きリストに繋げる
+    uint8_t *objects = (uint8_t *) slab + SLAB_HEADER_SIZE;
+    for (unsigned i = cache->objects_per_slab; i > 0; i--) {
+        void **obj = (void **) &objects[(i - 1) * cache->object_size];
+        *obj = slab->free_objects;
+        slab->free_objects = obj;
+    }
+
+    list_elem_init(&slab->next);
+    list_push_back(&cache->partial_slabs, &slab->next);
+    cache->num_slabs++;
+    return OK;
+}
+
+// スラブから空きオブジェクトを1つ取り出す。空きがなければ新しいスラブを割り当てる。
+static void *alloc_from_slabs(struct slab_cache *cache) {
+    if (list_is_empty(&cache->partial_slabs) && grow_cache(cache) != OK) {
+        return NULL;
+    }
+
+    struct slab *slab =
+        LIST_CONTAINER(cache->partial_slabs.next, struct slab, next);
+    void **obj = slab->free_objects;
+    slab->free_objects = *obj;
+    slab->num_free--;
+    if (slab->num_free == 0) {
+        // 空きのないスラブはリストから外し、オブジェクトが返されるまで放っておく
+        list_remove(&slab->next);
+    }
+
+    return obj;
+}
+
+// オブジェクトをスラブに戻す。スラブの全てのオブジェクトが空きになれば、スラブを解放する。
+static void free_to_slab(struct slab_cache *cache, void *obj) {
+    struct slab *slab = slab_of(cache, obj);
+    DEBUG_ASSERT(slab->cache == cache);
+
+    *(void **) obj = slab->free_objects;
+    slab->free_objects = obj;
+    slab->num_free++;
+    if (slab->num_free == 1) {
+        list_push_back(&cache->partial_slabs, &slab->next);
+    }
+
+    if (slab->num_free == cache->objects_per_slab) {
+        list_remove(&slab->next);
+        cache->num_slabs--;
+        pm_free(slab->paddr, cache->slab_size);
+    }
+}
+
+// オブジェクトを割り当てる。中身は初期化されない。メモリが足りなければNULLを返す。
+//
+// まず実行中のCPUのマガジンから取り出し、マガジンが空の場合はスラブからまとめて補充する。
+// 直前に同じCPUで解放されたオブジェクトほど先に再利用されるので、CPUキャッシュに残って
+// いる可能性が高い。
+void *slab_alloc(struct slab_cache *cache) {
+    if (!cache->slab_size) {
+        init_cache(cache);
+    }
+
+    struct slab_magazine *mag = &cache->magazines[CPUVAR->id];
+    if (mag->count == 0) {
+        while (mag->count < SLAB_MAGAZINE_BATCH) {
+            void *obj = alloc_from_slabs(cache);
+            if (!obj) {
+                break;
+            }
+
+            mag->objects[mag->count++] = obj;
+        }
+
+        if (mag->count == 0) {
+            return NULL;
+        }
+    }
+
+    cache->num_objects++;
+    return mag->objects[--mag->count];
+}
+
+// オブジェクトを解放する。objはslab_alloc関数で同じキャッシュから割り当てたもの。
+//
+// 実行中のCPUのマガジンに戻し、マガジンが一杯の場合は一部をまとめてスラブに戻す。
+void slab_free(struct slab_cache *cache, void *obj) {
+    DEBUG_ASSERT(cache->slab_size);
+
+    struct slab_magazine *mag = &cache->magazines[CPUVAR->id];
+    if (mag->count == SLAB_MAGAZINE_SIZE) {
+        while (mag->count > SLAB_MAGAZINE_SIZE - SLAB_MAGAZINE_BATCH) {
+            free_to_slab(cache, mag->objects[--mag->count]);
+        }
+    }
+
+    mag->objects[mag->count++] = obj;
+    cache->num_objects--;
+}
+
+// スラブアロケータの自己テスト。起動時に呼ばれる。
+//
+// 複数のスラブにまたがる数のオブジェクトを割り当て、互いに重ならないことを確認する。直前に
+// 解放したオブジェクトが次の割り当てで再利用されること、全て解放してマガジンを空にすると
+// スラブが全て解放されることも確認する。
+void slab_selftest(void) {
+    static struct slab_cache cache = SLAB_CACHE_INIT("selftest", uint8_t[128]);
+    static uint8_t *objs[SLAB_SELFTEST_OBJECTS];
+
+    for (unsigned i = 0; i < SLAB_SELFTEST_OBJECTS; i++) {
+        objs[i] = slab_alloc(&cache);
+        ASSERT(objs[i] != NULL);
+        ASSERT(slab_of(&cache, objs[i])->cache == &cache);
+        memset(objs[i], i, cache.object_size);
+    }
+
+    ASSERT(cache.num_objects == SLAB_SELFTEST_OBJECTS);
+    ASSERT(cache.num_slabs > 1);
+    for (unsigned i = 0; i < SLAB_SELFTEST_OBJECTS; i++) {
+        for (size_t j = 0; j < cache.object_size; j++) {
+            ASSERT(objs[i][j] == (uint8_t) i);
+        }
+    }
+
+    void *last = objs[SLAB_SELFTEST_OBJECTS - 1];
+    slab_free(&cache, last);
+    ASSERT(slab_alloc(&cache) == last);
+
+    for (unsigned i = 0; i < SLAB_SELFTEST_OBJECTS; i++) {
+        slab_free(&cache, objs[i]);
+    }
+
+    struct slab_magazine *mag = &cache.magazines[CPUVAR->id];
+    while (mag->count > 0) {
+        free_to_slab(&cache, mag->objects[--mag->count]);
+    }
+
+    ASSERT(cache.num_objects == 0 && cache.num_slabs == 0);
+
+    // 統計情報の一覧から外す
+    struct slab_cache **prev = &all_caches;
+    while (*prev != &cache) {
+        prev = &(*prev)->next_cache;
+    }
+    *prev = cache.next_cache;
+    TRACE("slab: alloc/free OK");
+}
+
+// デバッグ用に各キャッシュの統計情報を表示する。
+void slab_dump(void) {
+    WARN("slab caches:");
+    for (struct slab_cache *cache = all_caches; cache;
+         cache = cache->next_cache) {
+        WARN("  %s: %u objects in %u slabs (%d bytes/object, %u objects/slab)",
+             cache->name, cache->num_objects, cache->num_slabs,
+             cache->object_size, cache->objects_per_slab);
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "arch.h"
+#include <libs/common/list.h>
+#include <libs/common/types.h>
+
+// 1つのスラブに最低限入れるオブジェクトの数。スラブのサイズはこれを満たす最小の2のべき乗
+// ページ数になる。
+#define SLAB_OBJECTS_MIN 8
+// 各CPUのマガジンに保持するオブジェクトの最大数
+#define SLAB_MAGAZINE_SIZE 16
+// マガジンとスラブの間でまとめて移動するオブジェクトの数
+#define SLAB_MAGAZINE_BATCH 8
+
+// 各CPUのマガジン。解放されたオブジェクトをスラブに戻さずに保持しておき、同じCPUでの次の
+// 割り当てに再利用する。
+struct slab_magazine {
+    unsigned count;                     // 保持しているオブジェクトの数
+    void *objects[SLAB_MAGAZINE_SIZE];  // 保持しているオブジェクト
+};
+
+// オブジェクトキャッシュ。同じ大きさのオブジェクトをスラブ (連続した物理ページ) から
+// 切り出して割り当てる。
+struct slab_cache {
+    const char *name;               // キャッシュの名前 (デバッグ用)
+    size_t object_size;             // オブジェクトのサイズ
+    size_t slab_size;               // スラブのサイズ (0なら未初期化)
+    unsigned objects_per_slab;      // 1つのスラブに入るオブジェクトの数
+    list_t partial_slabs;           // 空きオブジェクトを持つスラブのリスト
+    unsigned num_slabs;             // 割り当て済みのスラブの数
+    unsigned num_objects;           // 割り当て済みのオブジェクトの数
+    struct slab_cache *next_cache;  // キャッシュの一覧の次のキャッシュ
+    struct slab_magazine magazines[NUM_CPUS_MAX];  // 各CPUのマガジン
+};
+
+// オブジェクトキャッシュを初期化する。static変数でキャッシュを宣言する場合に使う。スラブ
+// は最初の割り当て時に用意される。
+#define SLAB_CACHE_INIT(cache_name, type)                                      \
+    { .name = (cache_name), .object_size = sizeof(type) }
+
+void *slab_alloc(struct slab_cache *cache);
+void slab_free(struct slab_cache *cache, void *obj);
+void slab_selftest(void);
+void slab_dump(void);
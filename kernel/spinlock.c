@@ -0,0 +1,103 @@
+#include "spinlock.h"
+#include "arch.h"
+#include "printk.h"
+#include <libs/common/string.h>
+
+// 一度でも取得されたスピンロックの一覧 (統計情報の表示用)
+static struct spinlock *all_locks = NULL;
+
+// スピンロックを統計情報の一覧に追加する。ロックを持っているCPUが呼び出すので、同じロック
+// が二重に追加されることはないが、他のロックの追加とは競合するのでアトミックに追加する。
+static void register_lock(struct spinlock *lock) {
+    lock->registered = true;
+    do {
+        lock->next_lock = atomic_load(&all_locks);
+    } while (!compare_and_swap(&all_locks, lock->next_lock, lock));
+}
+
+// スピンロックを取得する。他のCPUが解放するまで待ち続ける。
+void spin_lock(struct spinlock *lock) {
+    if (lock->owner == CPUVAR->id) {
+        PANIC("recursive lock: %s (CPU #%d)", lock->name, CPUVAR->id);
+    }
+
+    // チケットを取り、自分の番が来るまで待つ
+    uint32_t started_at = arch_read_cycles();
+    uint32_t ticket = atomic_fetch_and_add(&lock->next_ticket, 1);
+    bool contended = false;
+    while (atomic_load(&lock->now_serving) != ticket) {
+        // ロックを持っているCPUがTLB shootdownの完了を待っているかもしれない
+        arch_handle_tlb_flush();
+        contended = true;
+    }
+
+    // ここ以降のメモリ読み書きが上のロック取得前に行われないようにする (メモリバリア)
+    full_memory_barrier();
+    lock->owner = CPUVAR->id;
+    if (!lock->registered) {
+        register_lock(lock);
+    }
+
+    // 統計情報を更新する
+    uint32_t now = arch_read_cycles();
+    uint32_t wait = now - started_at;
+    struct lock_stats *stats = &lock->stats;
+    stats->acquired++;
+    if (contended) {
+        stats->contended++;
+        stats->wait_cycles += wait;
+        stats->max_wait_cycles = MAX(stats->max_wait_cycles, wait);
+    }
+
+    lock->acquired_at = now;
+}
+
+// スピンロックを解放する。
+void spin_unlock(struct spinlock *lock) {
+    DEBUG_ASSERT(lock->owner == CPUVAR->id);
+
+    // 統計情報を更新する
+    uint32_t hold = arch_read_cycles() - lock->acquired_at;
+    lock->stats.hold_cycles += hold;
+    lock->stats.max_hold_cycles = MAX(lock->stats.max_hold_cycles, hold);
+
+    lock->owner = -1;
+
+    // ここ以前のメモリ読み書きが下のロック解放前に行われるようにする (メモリバリア)
+    full_memory_barrier();
+    atomic_fetch_and_add(&lock->now_serving, 1);
+}
+
+// デバッグ用に各スピンロックの統計情報を表示する。合計時間は1024サイクル単位で表示する。
+void spinlock_dump(void) {
+    WARN("locks (cycles):");
+    for (struct spinlock *lock = atomic_load(&all_locks); lock;
+         lock = lock->next_lock) {
+        struct lock_stats *stats = &lock->stats;
+        WARN("  %s: acquired=%u, contended=%u, wait=%uK (max %u), "
+             "hold=%uK (max %u)",
+             lock->name, stats->acquired, stats->contended,
+             (uint32_t) (stats->wait_cycles >> 10), stats->max_wait_cycles,
+             (uint32_t) (stats->hold_cycles >> 10), stats->max_hold_cycles);
+    }
+}
+
+// 各スピンロックの統計情報をリセットする。
+void spinlock_reset_stats(void) {
+    for (struct spinlock *lock = atomic_load(&all_locks); lock;
+         lock = lock->next_lock) {
+        // 自身が持っているロック (カーネルロックなど) はそのままリセットし、それ以外は
+        // ロックを取得してからリセットする。
+        bool locked = lock->owner != CPUVAR->id;
+        if (locked) {
+            spin_lock(lock);
+        }
+
+        memset(&lock->stats, 0, sizeof(lock->stats));
+        lock->acquired_at = arch_read_cycles();
+
+        if (locked) {
+            spin_unlock(lock);
+        }
+    }
+}
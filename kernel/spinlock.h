@@ -0,0 +1,38 @@
+#pragma once
+#include <libs/common/types.h>
+
+// ロックの統計情報。ロックを持っている間に更新する。時間はCPUのサイクル数。
+struct lock_stats {
+    uint32_t acquired;         // 取得した回数
+    uint32_t contended;        // 取得時に他のCPUを待った回数
+    uint64_t wait_cycles;      // 取得を待っていた時間の合計
+    uint64_t hold_cycles;      // ロックを持っていた時間の合計
+    uint32_t max_wait_cycles;  // 取得を待っていた時間の最大値
+    uint32_t max_hold_cycles;  // ロックを持っていた時間の最大値
+};
+
+// スピンロック (チケットロック)。カーネルロック (mp_lock) とは別に、特定のデータ構造だけを
+// 保護するために使う。取得しようとした順番にロックを取得できるので、特定のCPUが延々と
+// 待たされることがない。
+//
+// ロックの取得順序: カーネルロックを持ったままスピンロックを取得してもよいが、スピンロックを
+// 持ったままカーネルロックを取得してはならない (デッドロックになる)。
+struct spinlock {
+    uint32_t next_ticket;        // 次に取得しようとするCPUに渡すチケット番号
+    uint32_t now_serving;        // ロックを取得できるチケット番号
+    int owner;                   // ロックを持っているCPUのID (デバッグ用)
+    const char *name;            // ロックの名前 (デバッグ用)
+    bool registered;             // 統計情報の一覧 (all_locks) に登録済みかどうか
+    struct spinlock *next_lock;  // 統計情報の一覧の次のロック
+    uint32_t acquired_at;        // ロックを取得した時刻 (サイクル数)
+    struct lock_stats stats;     // 統計情報
+};
+
+// スピンロックを初期化する。static変数でスピンロックを宣言する場合に使う。
+#define SPINLOCK_INIT(lock_name)                                               \
+    { .owner = -1, .name = (lock_name) }
+
+void spin_lock(struct spinlock *lock);
+void spin_unlock(struct spinlock *lock);
+void spinlock_dump(void);
+void spinlock_reset_stats(void);
@@ -5,6 +5,7 @@
 #include "ipc.h"
 #include "memory.h"
 #include "printk.h"
+#include "spinlock.h"
 #include "task.h"
 #include <libs/common/string.h>
 
@@ -106,24 +107,81 @@ static task_t sys_hinavm(__user const char *name, __user hinavm_inst_t *insts,
     return hinavm_create(namebuf, instsbuf, num_insts, pager_task);
 }
 
-// タスクを削除する。
+// タスクを削除する。スレッドは個別に削除できない (thread_joinシステムコールを使う)。
 static error_t sys_task_destroy(task_t tid) {
     struct task *task = task_find(tid);
-    if (!task || task == CURRENT_TASK) {
+    if (!task || task == CURRENT_TASK->leader || task->leader != task) {
         return ERR_INVALID_TASK;
     }
 
     return task_destroy(task);
 }
 
+// タスクの優先度を変更する。ページャータスクは任意の優先度を設定できるが、タスク自身は
+// 優先度を下げることしかできない。
+static error_t sys_task_priority(task_t tid, int priority) {
+    struct task *task = task_find(tid);
+    if (!task) {
+        return ERR_INVALID_TASK;
+    }
+
+    if (task->pager != CURRENT_TASK->leader) {
+        if (task->leader != CURRENT_TASK->leader) {
+            return ERR_INVALID_TASK;
+        }
+
+        if (priority < task->priority) {
+            return ERR_NOT_ALLOWED;
+        }
+    }
+
+    return task_set_priority(task, priority);
+}
+
+// タスクのCPUアフィニティ (実行してよいCPUのビットマップ) を変更する。ページャータスクは
+// 任意のアフィニティを設定できるが、タスク自身は実行してよいCPUを減らすことしかできない。
+static error_t sys_task_affinity(task_t tid, uint32_t affinity) {
+    struct task *task = task_find(tid);
+    if (!task) {
+        return ERR_INVALID_TASK;
+    }
+
+    if (task->pager != CURRENT_TASK->leader) {
+        if (task->leader != CURRENT_TASK->leader) {
+            return ERR_INVALID_TASK;
+        }
+
+        if (affinity & ~task->affinity) {
+            return ERR_NOT_ALLOWED;
+        }
+    }
+
+    return task_set_affinity(task, affinity);
+}
+
 // 実行中タスクを正常終了する。
 __noreturn static void sys_task_exit(void) {
     task_exit(EXP_GRACE_EXIT);
 }
 
-// 実行中タスクのタスクIDを取得する。
+// 実行中タスクのタスクIDを取得する。スレッドの場合は、アドレス空間を所有するタスク
+// (リーダー) のタスクIDを返す。
 static task_t sys_task_self(void) {
-    return CURRENT_TASK->tid;
+    return CURRENT_TASK->leader->tid;
+}
+
+// 実行中タスクと同じアドレス空間で動くスレッドを作成する。
+static task_t sys_thread_create(uaddr_t ip, uaddr_t sp, uaddr_t arg) {
+    if (!arch_is_mappable_uaddr(ip) || !arch_is_mappable_uaddr(sp)) {
+        return ERR_INVALID_UADDR;
+    }
+
+    return thread_create(CURRENT_TASK, ip, sp, arg);
+}
+
+// スレッドの終了を待ち、そのスレッドを削除する。
+static error_t sys_thread_join(task_t tid) {
+    return thread_join(tid);
 }
 
 // 物理ページを割り当てる。
@@ -136,13 +194,14 @@ static pfn_t sys_pm_alloc(task_t tid, size_t size, unsigned flags) {
         return ERR_INVALID_ARG;
     }
 
-    // 所有者となるタスクを取得
+    // 所有者となるタスクを取得。スレッドの場合はリーダーが所有者となる。
     struct task *task = task_find(tid);
     if (!task) {
         return ERR_INVALID_TASK;
     }
 
-    if (task != CURRENT_TASK && task->pager != CURRENT_TASK) {
+    task = task->leader;
+    if (task != CURRENT_TASK->leader && task->pager != CURRENT_TASK->leader) {
         return ERR_INVALID_TASK;
     }
 
@@ -158,12 +217,14 @@ static pfn_t sys_pm_alloc(task_t tid, size_t size, unsigned flags) {
 // ページを仮想アドレス空間にマップする。
 static paddr_t sys_vm_map(task_t tid, uaddr_t uaddr, paddr_t paddr,
                           unsigned attrs) {
-    // 操作対象のタスクを取得
+    // 操作対象のタスクを取得。スレッドの場合はリーダーのアドレス空間を操作する。
     struct task *task = task_find(tid);
     if (!task) {
         return ERR_INVALID_TASK;
     }
 
+    task = task->leader;
+
     // 未知・許可されていないフラグが指定されていないかチェック
     if ((attrs & ~(PAGE_WRITABLE | PAGE_READABLE | PAGE_EXECUTABLE)) != 0) {
         return ERR_INVALID_ARG;
@@ -185,12 +246,14 @@ static paddr_t sys_vm_map(task_t tid, uaddr_t uaddr, paddr_t paddr,
 
 // ページを仮想アドレス空間からアンマップする。
 static paddr_t sys_vm_unmap(task_t tid, uaddr_t uaddr) {
-    // 操作対象のタスクを取得
+    // 操作対象のタスクを取得。スレッドの場合はリーダーのアドレス空間を操作する。
     struct task *task = task_find(tid);
     if (!task) {
         return ERR_INVALID_TASK;
     }
 
+    task = task->leader;
+
     // ページ境界にアラインされているかチェック
     if (!IS_ALIGNED(uaddr, PAGE_SIZE)) {
         return ERR_INVALID_ARG;
@@ -204,16 +267,30 @@ static paddr_t sys_vm_unmap(task_t tid, uaddr_t uaddr) {
     return vm_unmap(task, uaddr);
 }
 
-// メッセージを送受信する。
+// メッセージを送受信する。ool_windowはページ単位のバッファ (ool) の受信先アドレス。
 static error_t sys_ipc(task_t dst, task_t src, __user struct message *m,
-                       unsigned flags) {
+                       unsigned flags, uaddr_t ool_window) {
     // 許可されていないフラグが指定されていないかチェック
-    if ((flags & ~(IPC_SEND | IPC_RECV | IPC_NOBLOCK)) != 0) {
+    if ((flags
+         & ~(IPC_SEND | IPC_RECV | IPC_NOBLOCK | IPC_REPLY | IPC_IOV
+             | IPC_ASYNC | IPC_TIMEOUT_MAX | IPC_PORT(IPC_PORTS_MAX - 1)
+             | IPC_PORTS((1 << IPC_PORTS_MAX) - 1)))
+        != 0) {
+        return ERR_INVALID_ARG;
+    }
+
+    // 非同期メッセージは送信のみで、宛先はポート0のみ
+    if ((flags & IPC_ASYNC) && ((flags & IPC_RECV) || IPC_GET_PORT(flags))) {
+        return ERR_INVALID_ARG;
+    }
+
+    // ページ単位のバッファの受信先はページ境界にアラインされている必要がある
+    if (!IS_ALIGNED(ool_window, PAGE_SIZE)) {
         return ERR_INVALID_ARG;
     }
 
     // 有効なタスクIDかチェック
-    if (src < 0 || src > NUM_TASKS_MAX) {
+    if (src < 0) {
         return ERR_INVALID_ARG;
     }
 
@@ -222,11 +299,17 @@ static error_t sys_ipc(task_t dst, task_t src, __user struct message *m,
     if (flags & IPC_SEND) {
         dst_task = task_find(dst);
         if (!dst_task) {
-            return ERR_INVALID_TASK;
+            if (!(flags & IPC_REPLY)) {
+                return ERR_INVALID_TASK;
+            }
+
+            // 返信先のタスクが既に終了している場合は、返信を破棄して受信操作のみを行う
+            WARN("reply destination #%d does not exist", dst);
+            flags &= ~IPC_SEND;
         }
     }
 
-    return ipc(dst_task, src, m, flags);
+    return ipc(dst_task, src, m, flags, ool_window);
 }
 
 // 通知を送信する。
@@ -258,15 +341,18 @@ static int sys_serial_write(__user const char *buf, size_t buf_len) {
     char kbuf[512];
     int remaining = written_len;
     while (remaining > 0) {
-        // 書き込む文字列を一時バッファにコピーする。
+        // 書き込む文字列を一時バッファにコピーする。ページフォルトが発生する可能性があるので、
+        // カーネルロックを持ったまま行う。
         int copy_len = MIN(remaining, (int) sizeof(kbuf));
         memcpy_from_user(kbuf, buf, copy_len);
 
-        // 一時バッファの内容をシリアルポートに書き込む。
-        for (int i = 0; i < copy_len; i++) {
-            arch_serial_write(kbuf[i]);
-        }
+        // 一時バッファの内容をシリアルポートに書き込む。時間がかかるので、その間はカーネル
+        // ロックを解放して他のCPUがカーネルに入れるようにする。
+        arch_unlock();
+        serial_write(kbuf, copy_len);
+        arch_lock();
 
+        buf += copy_len;
         remaining -= copy_len;
     }
 
@@ -285,20 +371,43 @@ static int sys_serial_read(__user char *buf, int max_len) {
 }
 
 // タイムアウトを設定する。呼び出した時点から指定した時間 (ミリ秒) が経過すると、タスクに通知が
-// 送られる。値がゼロの場合は、タイムアウトを解除する。
-static error_t sys_time(int timeout) {
-    if (timeout < 0) {
+// 送られる。値がゼロの場合は、タイムアウトを解除する。idはタイマーの番号で、タスクごとに
+// TASK_TIMERS_MAX個のタイマーを独立して設定できる。
+static error_t sys_time(int timeout, unsigned id) {
+    if (timeout < 0 || id >= TASK_TIMERS_MAX) {
         return ERR_INVALID_ARG;
     }
 
     // タイムアウト時間を更新する
-    CURRENT_TASK->timeout = (timeout == 0) ? 0 : (timeout * (TICK_HZ / 1000));
+    struct timer *timer = &CURRENT_TASK->timers[id].timer;
+    if (timeout == 0) {
+        timer_cancel(timer);
+        CURRENT_TASK->timers_fired &= ~(1U << id);
+    } else {
+        timer_set(timer, timeout);
+    }
+
     return OK;
 }
 
 // 起動してからの経過時間をミリ秒単位で返す。
 static int sys_uptime(void) {
-    return uptime_ticks / TICK_HZ;
+    return arch_uptime_ticks() / TICK_HZ;
+}
+
+// カーネル内のロックとIPCのスピンの統計情報をシリアルポートに表示する。
+static error_t sys_lock_stats(unsigned flags) {
+    if (flags & ~LOCK_STATS_RESET) {
+        return ERR_INVALID_ARG;
+    }
+
+    spinlock_dump();
+    ipc_dump();
+    if (flags & LOCK_STATS_RESET) {
+        spinlock_reset_stats();
+    }
+
+    return OK;
 }
 
 // コンピューターの電源を切る。
@@ -311,7 +420,7 @@ long handle_syscall(long a0, long a1, long a2, long a3, long a4, long n) {
     long ret;
     switch (n) {
         case SYS_IPC:
-            ret = sys_ipc(a0, a1, (__user struct message *) a2, a3);
+            ret = sys_ipc(a0, a1, (__user struct message *) a2, a3, a4);
             break;
         case SYS_NOTIFY:
             ret = sys_notify(a0, a1);
@@ -334,6 +443,21 @@ long handle_syscall(long a0, long a1, long a2, long a3, long a4, long n) {
         case SYS_TASK_SELF:
             ret = sys_task_self();
             break;
+        case SYS_TASK_PRIORITY:
+            ret = sys_task_priority(a0, a1);
+            break;
+        case SYS_TASK_AFFINITY:
+            ret = sys_task_affinity(a0, a1);
+            break;
+        case SYS_THREAD_CREATE:
+            ret = sys_thread_create(a0, a1, a2);
+            break;
+        case SYS_THREAD_JOIN:
+            ret = sys_thread_join(a0);
+            break;
+        case SYS_LOCK_STATS:
+            ret = sys_lock_stats(a0);
+            break;
         case SYS_PM_ALLOC:
             ret = sys_pm_alloc(a0, a1, a2);
             break;
@@ -354,7 +478,7 @@ long handle_syscall(long a0, long a1, long a2, long a3, long a4, long n) {
                              (__user hinavm_inst_t *) a1, a2, a3);
             break;
         case SYS_TIME:
-            ret = sys_time(a0);
+            ret = sys_time(a0, a1);
             break;
         case SYS_UPTIME:
             ret = sys_uptime();
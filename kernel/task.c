@@ -3,56 +3,276 @@
 #include "ipc.h"
 #include "memory.h"
 #include "printk.h"
+#include "slab.h"
+#include "spinlock.h"
 #include <libs/common/list.h>
 #include <libs/common/string.h>
 
-static struct task tasks[NUM_TASKS_MAX];        // 全てのタスク管理構造体 (未使用含む)
-static struct task idle_tasks[NUM_CPUS_MAX];    // 各CPUのアイドルタスク
-static list_t runqueue = LIST_INIT(runqueue);   // ランキュー
-list_t active_tasks = LIST_INIT(active_tasks);  // 使用中の管理構造体のリスト
+static struct task *tasks[NUM_TASKS_MAX];          // タスク番号から管理構造体への表
+static int num_tasks = 0;                          // 割り当て済みの管理構造体の数
+static list_t free_tasks = LIST_INIT(free_tasks);  // 未使用の管理構造体のリスト
+static struct task idle_tasks[NUM_CPUS_MAX];       // 各CPUのアイドルタスク
+list_t active_tasks = LIST_INIT(active_tasks);     // 使用中の管理構造体のリスト
+
+// タスク管理構造体とHinaVMの命令列のオブジェクトキャッシュ
+static struct slab_cache task_cache = SLAB_CACHE_INIT("task", struct task);
+static struct slab_cache hinavm_cache =
+    SLAB_CACHE_INIT("hinavm", struct hinavm);
+
+// ランキューで待っているタスクの最も高い優先度を返す。空の場合は-1を返す。
+static int runqueue_top(struct runqueue *rq) {
+    while (rq->bitmap) {
+        int priority = __builtin_ctz(rq->bitmap);
+        if (!list_is_empty(&rq->queues[priority])) {
+            return priority;
+        }
+
+        // task_switch_to関数などでキューから直接取り除かれて空になっている
+        rq->bitmap &= ~(1U << priority);
+    }
+
+    return -1;
+}
+
+// ランキューから最も優先度の高いタスクを取り出す。空の場合はNULLを返す。
+static struct task *runqueue_pop(struct runqueue *rq) {
+    int priority = runqueue_top(rq);
+    if (priority < 0) {
+        return NULL;
+    }
+
+    list_t *queue = &rq->queues[priority];
+    struct task *task = LIST_POP_FRONT(queue, struct task, waitqueue_next);
+    if (list_is_empty(queue)) {
+        rq->bitmap &= ~(1U << priority);
+    }
+
+    return task;
+}
+
+// ランキューの末尾にタスクを追加する。
+static void runqueue_push(struct runqueue *rq, struct task *task) {
+    list_push_back(&rq->queues[task->priority], &task->waitqueue_next);
+    rq->bitmap |= 1U << task->priority;
+}
+
+// 起動済みのCPUのビットマップを返す。
+static uint32_t online_cpus(void) {
+    uint32_t cpus = 0;
+    for (int i = 0; i < NUM_CPUS_MAX; i++) {
+        if (arch_cpuvar_of(i)->online) {
+            cpus |= 1U << i;
+        }
+    }
+
+    return cpus;
+}
+
+// タスクを指定したCPUで実行してよいかを返す。アフィニティで指定されたCPUが1つも起動して
+// いない (ブート中など) 場合は、どのCPUで実行してもよいものとする。
+static bool is_allowed_cpu(struct task *task, struct cpuvar *cpuvar) {
+    if (task->affinity & (1U << cpuvar->id)) {
+        return true;
+    }
+
+    return (task->affinity & online_cpus()) == 0;
+}
+
+// ランキューから指定したCPUで実行してよい最も優先度の高いタスクを取り出す。ワークスティー
+// リング用。見つからなければNULLを返す。
+static struct task *runqueue_steal(struct runqueue *rq, struct cpuvar *cpuvar) {
+    uint32_t bitmap = rq->bitmap;
+    while (bitmap) {
+        int priority = __builtin_ctz(bitmap);
+        LIST_FOR_EACH (task, &rq->queues[priority], struct task,
+                       waitqueue_next) {
+            if (is_allowed_cpu(task, cpuvar)) {
+                // キューが空になってもビットマップはrunqueue_top関数が後で更新する
+                list_remove(&task->waitqueue_next);
+                return task;
+            }
+        }
+
+        bitmap &= ~(1U << priority);
+    }
+
+    return NULL;
+}
+
+// 他のCPUのランキューから実行可能なタスクを1つ奪う (ワークスティーリング)。自身のCPUで
+// 実行するタスクがない場合に呼ばれる。
+static struct task *steal_task(void) {
+    for (int i = 1; i < NUM_CPUS_MAX; i++) {
+        struct cpuvar *cpuvar = arch_cpuvar_of((CPUVAR->id + i) % NUM_CPUS_MAX);
+        if (!cpuvar->online) {
+            continue;
+        }
+
+        struct task *task = runqueue_steal(&cpuvar->runqueue, CPUVAR);
+        if (task) {
+            return task;
+        }
+    }
+
+    return NULL;
+}
+
+// 実行可能になったタスクを実行するCPUを選ぶ。
+static struct cpuvar *pick_cpu(struct task *task) {
+    // キャッシュに残っているデータを活かすため、最後に実行されたCPUが自身か、アイドル状態
+    // であればそのCPUで実行する。
+    struct cpuvar *cpuvar = arch_cpuvar_of(task->cpu);
+    bool last_allowed = cpuvar->online && is_allowed_cpu(task, cpuvar);
+    if (last_allowed && (cpuvar == CPUVAR || cpuvar->idle)) {
+        return cpuvar;
+    }
+
+    // 自身のCPUがアイドルタスクを実行中 (割り込み処理中) であれば、すぐに実行できる。
+    if (CURRENT_TASK == IDLE_TASK && is_allowed_cpu(task, CPUVAR)) {
+        return CPUVAR;
+    }
+
+    // 最後に実行されたCPUが忙しければ、アイドル状態の他のCPUで実行する。
+    for (int i = 1; i < NUM_CPUS_MAX; i++) {
+        struct cpuvar *other = arch_cpuvar_of((CPUVAR->id + i) % NUM_CPUS_MAX);
+        if (other->online && other->idle && is_allowed_cpu(task, other)) {
+            return other;
+        }
+    }
+
+    // 全てのCPUが忙しい。最後に実行されたCPUのランキューに入れて、先に手が空いたCPUが
+    // ワークスティーリングで実行する。
+    if (last_allowed) {
+        return cpuvar;
+    }
+
+    // 最後に実行されたCPUでは実行できない (アフィニティが変更された)。実行してよいCPUの
+    // うち、自身のCPUから順に探す。
+    for (int i = 0; i < NUM_CPUS_MAX; i++) {
+        struct cpuvar *other = arch_cpuvar_of((CPUVAR->id + i) % NUM_CPUS_MAX);
+        if (other->online && is_allowed_cpu(task, other)) {
+            return other;
+        }
+    }
+
+    UNREACHABLE();
+}
+
+// 実行可能なタスクをいずれかのCPUのランキューに入れる。
+static void enqueue_task(struct task *task) {
+    struct cpuvar *cpuvar = pick_cpu(task);
+    runqueue_push(&cpuvar->runqueue, task);
+    task->cpu = cpuvar->id;
+
+    // 眠っているCPUはIPIで起こしてすぐに実行させる。同じCPUに何度もIPIを送らないように、
+    // 起こしたCPUはもうアイドル状態ではないものとして扱う。
+    if (cpuvar != CPUVAR && cpuvar->idle) {
+        cpuvar->idle = false;
+        arch_send_ipi_to(cpuvar->id, IPI_RESCHEDULE);
+    }
+}
 
 // 次に実行するタスクを選択する。
 static struct task *scheduler(void) {
-    // ランキューから実行可能なタスクを取り出す。
-    struct task *next = LIST_POP_FRONT(&runqueue, struct task, waitqueue_next);
-    if (next) {
-        return next;
+    // アフィニティが変更されて自身のCPUで実行できなくなったタスクは続行しない。
+    struct task *current = CURRENT_TASK;
+    bool runnable = current->state == TASK_RUNNABLE && !current->destroyed
+                    && is_allowed_cpu(current, CPUVAR);
+
+    // 自身のCPUのランキューから実行可能なタスクを取り出す。実行中タスクより優先度が低い
+    // タスクしかない場合は、実行中タスクを続行する。同じ優先度のタスク同士は順番に実行する。
+    int top = runqueue_top(&CPUVAR->runqueue);
+    if (top >= 0 && (!runnable || top <= current->priority)) {
+        return runqueue_pop(&CPUVAR->runqueue);
     }
 
-    if (CURRENT_TASK->state == TASK_RUNNABLE && !CURRENT_TASK->destroyed) {
+    if (runnable) {
         // 他に実行可能なタスクがない場合は、実行中タスクを続行する。
-        return CURRENT_TASK;
+        return current;
+    }
+
+    // 他のCPUのランキューで待っているタスクがあれば、それを実行する。
+    struct task *next = steal_task();
+    if (next) {
+        return next;
     }
 
     return IDLE_TASK;  // 実行するタスクがない場合はアイドルタスクを実行する。
 }
 
-// タスク管理構造体を初期化する。
-static error_t init_task_struct(struct task *task, task_t tid, const char *name,
-                                vaddr_t ip, struct task *pager,
+// タイムアウト通知 (sys_time) で設定した時間が経過した。どのタイマーがタイムアウトしたかは
+// 通知メッセージで伝える。
+static void handle_timeout(void *arg) {
+    struct task_timer *timer = arg;
+    struct task *task = timer->task;
+    task->timers_fired |= 1U << (timer - task->timers);
+    notify(task, NOTIFY_TIMER);
+}
+
+// タスク管理構造体を初期化する。leaderがNULLでなければ、leaderのアドレス空間を共有する
+// スレッドとして初期化する。spはユーザースタックの初期値、argはスレッドの第1引数。
+static error_t init_task_struct(struct task *task, struct task *leader,
+                                task_t tid, const char *name, vaddr_t ip,
+                                uaddr_t sp, struct task *pager,
                                 vaddr_t kernel_entry, void *arg) {
     task->tid = tid;
     task->destroyed = false;
     task->quantum = 0;
-    task->timeout = 0;
+    task->priority = TASK_PRIORITY_DEFAULT;
+    task->cpu = CPUVAR->id;
+    task->affinity = TASK_AFFINITY_ANY;
+    task->ipc_timed_out = false;
+    task->spinning = false;
+    task->spin_budget = IPC_SPIN_MIN;
+    task->timers_fired = 0;
+    for (int i = 0; i < TASK_TIMERS_MAX; i++) {
+        task->timers[i].task = task;
+        timer_init(&task->timers[i].timer, handle_timeout, &task->timers[i]);
+    }
+
+    timer_init(&task->ipc_timer, ipc_handle_timeout, task);
     task->wait_for = IPC_DENY;
+    task->wait_ports = 0;
+    task->send_to = NULL;
+    task->send_port = 0;
+    task->handoff = 0;
+    task->ool_window = 0;
+    task->num_async_messages = 0;
     task->ref_count = 0;
     task->pager = pager;
+    task->leader = leader ? leader : task;
+    task->joiner = NULL;
+    task->exited = false;
+    task->hinavm = NULL;
 
     strcpy_safe(task->name, sizeof(task->name), name);
     list_elem_init(&task->waitqueue_next);
     list_elem_init(&task->next);
-    list_init(&task->senders);
-    list_init(&task->pages);
+    list_elem_init(&task->thread_next);
+    list_init(&task->threads);
+    for (int i = 0; i < IPC_PORTS_MAX; i++) {
+        list_init(&task->senders[i]);
+    }
 
-    error_t err = arch_vm_init(&task->vm);
-    if (err != OK) {
-        return err;
+    list_init(&task->pages);
+    list_init(&task->async_messages);
+
+    // スレッドはリーダーのページテーブルをそのまま使う
+    error_t err;
+    if (leader) {
+        task->vm = leader->vm;
+    } else {
+        err = arch_vm_init(&task->vm);
+        if (err != OK) {
+            return err;
+        }
     }
 
-    err = arch_task_init(task, ip, kernel_entry, arg);
+    err = arch_task_init(task, ip, sp, kernel_entry, arg);
     if (err != OK) {
-        arch_vm_destroy(&task->vm);
+        if (!leader) {
+            arch_vm_destroy(&task->vm);
+        }
         return err;
     }
 
@@ -78,39 +298,136 @@ void task_switch(void) {
 
     if (next == prev) {
         // 実行中タスク以外に実行可能なタスクがない。戻って処理を続ける。
+        timer_reload();
         return;
     }
 
     if (prev->state == TASK_RUNNABLE) {
         // 実行中タスクが実行可能な状態ならば、実行可能なタスクのキューに戻す。
-        // 与えられたCPU時間を使い切ったときに起きる。
-        list_push_back(&runqueue, &prev->waitqueue_next);
+        // 与えられたCPU時間を使い切ったときに起きる。アフィニティが変更されて自身のCPUで
+        // 実行できなくなった場合は、実行してよいCPUのランキューに移す。
+        if (is_allowed_cpu(prev, CPUVAR)) {
+            runqueue_push(&CPUVAR->runqueue, prev);
+        } else {
+            enqueue_task(prev);
+        }
+    }
+
+    // アイドルタスクが割り込みを受けて他のタスクに切り替える場合は、ここでアイドル状態を
+    // 解除する。arch_idle関数に戻るのはアイドルタスクが再び選ばれた後になるので、それまで
+    // 他のCPUからアイドル状態に見えてしまう。
+    if (prev == IDLE_TASK) {
+        CPUVAR->idle = false;
+    }
+
+    // タスクを切り替える
+    next->cpu = CPUVAR->id;
+    CURRENT_TASK = next;
+    timer_reload();
+    arch_task_switch(prev, next);
+}
+
+// 実行中タスクから指定したタスクへ、ランキューの順番を飛ばして直接切り替える (ダイレクト
+// スイッチ)。IPCの呼び出し元と呼び出し先の間でCPUを受け渡すのに使う。実行中タスクの残り
+// クォンタムはnextに引き継がれるので、呼び出し元と呼び出し先はあたかも一つのタスクのように
+// スケジュールされる。
+//
+// 実行中タスクはブロック状態でなければならない。nextが既に他のCPUで実行されている場合など、
+// 直接切り替えられない場合は何もせずにfalseを返す。呼び出し元はスピンするか、task_switch
+// 関数を呼ぶ。
+bool task_switch_to(struct task *next) {
+    struct task *prev = CURRENT_TASK;
+    DEBUG_ASSERT(prev->state == TASK_BLOCKED);
+
+    // 実行可能状態でランキューに入っていて、自身のCPUで実行してよいタスクのみ直接切り替え
+    // られる。
+    if (next->state != TASK_RUNNABLE || next->destroyed
+        || !list_is_linked(&next->waitqueue_next)
+        || !is_allowed_cpu(next, CPUVAR)) {
+        return false;
     }
 
+    // ランキューから取り除き、実行中タスクの残りのCPU時間を譲る。
+    list_remove(&next->waitqueue_next);
+    next->quantum = prev->quantum ? prev->quantum : TASK_QUANTUM;
+    prev->quantum = 0;
+
     // タスクを切り替える
+    next->cpu = CPUVAR->id;
     CURRENT_TASK = next;
+    timer_reload();
     arch_task_switch(prev, next);
+    return true;
+}
+
+// タスク管理構造体をキャッシュから割り当て、空きリストに追加する。管理構造体は必要になる
+// まで割り当てず、世代番号を保つために一度割り当てたものは解放せずに再利用する。
+static error_t grow_tasks(void) {
+    if (num_tasks == NUM_TASKS_MAX) {
+        return ERR_TOO_MANY_TASKS;
+    }
+
+    struct task *task = slab_alloc(&task_cache);
+    if (!task) {
+        return ERR_NO_MEMORY;
+    }
+
+    // タスク番号は1から始まる。世代番号は0から始まる。
+    memset(task, 0, sizeof(*task));
+    task->tid = num_tasks + 1;
+    task->state = TASK_UNUSED;
+    tasks[num_tasks] = task;
+    list_push_back(&free_tasks, &task->next);
+    num_tasks++;
+    return OK;
 }
 
-// 未使用のタスクIDを探す。
-static task_t alloc_tid(void) {
-    for (task_t i = 0; i < NUM_TASKS_MAX; i++) {
-        if (tasks[i].state == TASK_UNUSED) {
-            return i + 1;
+// 未使用のタスク管理構造体を取り出す。タスクIDはtask->tidに設定されている。
+static struct task *alloc_task(error_t *err) {
+    if (list_is_empty(&free_tasks)) {
+        *err = grow_tasks();
+        if (*err != OK) {
+            return NULL;
         }
     }
 
-    return 0;
+    return LIST_POP_FRONT(&free_tasks, struct task, next);
+}
+
+// タスク管理構造体を空きリストに戻す。世代番号を進めておき、次にこの管理構造体を使うタスク
+// が削除されたタスクと異なるIDを持つようにする。空きリストの末尾に戻すので、同じタスク番号
+// はなるべく再利用されない。
+static void free_task(struct task *task) {
+    unsigned generation =
+        ((task->tid >> TASK_INDEX_BITS) + 1) & TASK_GENERATION_MASK;
+    task->tid = (generation << TASK_INDEX_BITS) | TASK_INDEX(task->tid);
+    task->state = TASK_UNUSED;
+    list_push_back(&free_tasks, &task->next);
+}
+
+// タスク番号からタスク管理構造体を取得する。存在しない場合はNULLを返す。
+struct task *task_find_by_index(unsigned index) {
+    if (index == 0 || index > (unsigned) num_tasks) {
+        return NULL;
+    }
+
+    struct task *task = tasks[index - 1];
+    if (task->state == TASK_UNUSED) {
+        return NULL;
+    }
+
+    return task;
 }
 
 // タスクIDからタスク管理構造体を取得する。存在しない場合や無効なIDの場合はNULLを返す。
+// 削除されたタスクのID (世代番号が古いID) も無効なIDとして扱う。
 struct task *task_find(task_t tid) {
-    if (tid < 0 || tid >= NUM_TASKS_MAX) {
+    if (tid <= 0) {
         return NULL;
     }
 
-    struct task *task = &tasks[tid - 1];
-    if (task->state == TASK_UNUSED) {
+    struct task *task = task_find_by_index(TASK_INDEX(tid));
+    if (!task || task->tid != tid) {
         return NULL;
     }
 
@@ -131,22 +448,89 @@ void task_resume(struct task *task) {
     DEBUG_ASSERT(task->state == TASK_BLOCKED);
 
     task->state = TASK_RUNNABLE;
-    list_push_back(&runqueue, &task->waitqueue_next);
+
+    // 受信待ちでスピン中のタスクは他のCPUで実行中なので、ランキューには入れない。
+    if (task->spinning) {
+        return;
+    }
+
+    enqueue_task(task);
+}
+
+// 実行中タスクよりも優先度の高いタスクが自身のCPUのランキューで待っていれば、そのタスクに
+// 切り替える (プリエンプション)。割り込みハンドラから呼ばれる。
+void task_preempt(void) {
+    struct task *current = CURRENT_TASK;
+    int top = runqueue_top(&CPUVAR->runqueue);
+    if (current != IDLE_TASK && top >= 0 && top < current->priority) {
+        task_switch();
+    }
+}
+
+// タスクの優先度を変更する。
+error_t task_set_priority(struct task *task, int priority) {
+    if (priority < TASK_PRIORITY_HIGHEST || priority > TASK_PRIORITY_LOWEST) {
+        return ERR_INVALID_ARG;
+    }
+
+    // ランキューに入っている場合は、新しい優先度のキューに入れ直す
+    if (task->state == TASK_RUNNABLE && list_is_linked(&task->waitqueue_next)) {
+        list_remove(&task->waitqueue_next);
+        task->priority = priority;
+        enqueue_task(task);
+    } else {
+        task->priority = priority;
+    }
+
+    return OK;
+}
+
+// タスクのCPUアフィニティ (実行してよいCPUのビットマップ) を変更する。
+error_t task_set_affinity(struct task *task, uint32_t affinity) {
+    if ((affinity & ALL_CPUS_MASK) == 0) {
+        return ERR_INVALID_ARG;
+    }
+
+    task->affinity = affinity;
+
+    if (task->state != TASK_RUNNABLE && !task->spinning) {
+        // ブロックされている。次に実行可能になったときに実行するCPUが選ばれる。
+        return OK;
+    }
+
+    if (list_is_linked(&task->waitqueue_next)) {
+        // ランキューに入っている場合は、実行してよいCPUのランキューに入れ直す
+        list_remove(&task->waitqueue_next);
+        enqueue_task(task);
+    } else {
+        // いずれかのCPUで実行中。そのCPUで実行できなくなった場合は、コンテキストスイッチ
+        // させて実行してよいCPUに移す。
+        struct cpuvar *cpuvar = arch_cpuvar_of(task->cpu);
+        if (!is_allowed_cpu(task, cpuvar)) {
+            if (cpuvar == CPUVAR) {
+                task_switch();
+            } else {
+                arch_send_ipi_to(cpuvar->id, IPI_RESCHEDULE);
+            }
+        }
+    }
+
+    return OK;
 }
 
 // タスクを作成する。ipはユーザーモードで実行するアドレス (エントリーポイント)、pagerは
 // ページャータスク。
 task_t task_create(const char *name, uaddr_t ip, struct task *pager) {
-    task_t tid = alloc_tid();
-    if (!tid) {
-        return ERR_TOO_MANY_TASKS;
+    error_t err;
+    struct task *task = alloc_task(&err);
+    if (!task) {
+        return err;
     }
 
-    struct task *task = &tasks[tid - 1];
-    DEBUG_ASSERT(task != NULL);
-
-    error_t err = init_task_struct(task, tid, name, ip, pager, 0, NULL);
+    task_t tid = task->tid;
+    err = init_task_struct(task, NULL, tid, name, ip, 0, pager, 0, NULL);
     if (err != OK) {
+        free_task(task);
         return err;
     }
 
@@ -160,45 +544,147 @@ task_t task_create(const char *name, uaddr_t ip, struct task *pager) {
 // hinavm.c ではなくここで書かれているのは、init_task_struct関数などを呼び出すため。
 task_t hinavm_create(const char *name, hinavm_inst_t *insts, uint32_t num_insts,
                      struct task *pager) {
-    task_t tid = alloc_tid();
-    if (!tid) {
-        return ERR_TOO_MANY_TASKS;
+    error_t err;
+    struct task *task = alloc_task(&err);
+    if (!task) {
+        return err;
     }
 
-    struct task *task = &tasks[tid - 1];
-    DEBUG_ASSERT(task != NULL);
-
-    size_t hinavm_size = ALIGN_UP(sizeof(struct hinavm), PAGE_SIZE);
-    paddr_t hinavm_paddr = pm_alloc(hinavm_size, NULL, PM_ALLOC_UNINITIALIZED);
-    if (!hinavm_paddr) {
+    task_t tid = task->tid;
+    struct hinavm *hinavm = slab_alloc(&hinavm_cache);
+    if (!hinavm) {
+        free_task(task);
         return ERR_NO_MEMORY;
     }
 
-    struct hinavm *hinavm = (struct hinavm *) arch_paddr_to_vaddr(hinavm_paddr);
     memcpy(&hinavm->insts, insts, sizeof(hinavm_inst_t) * num_insts);
     hinavm->num_insts = num_insts;
 
-    error_t err = init_task_struct(task, tid, name, 0, pager,
-                                   (vaddr_t) hinavm_run, hinavm);
+    err = init_task_struct(task, NULL, tid, name, 0, 0, pager,
+                           (vaddr_t) hinavm_run, hinavm);
     if (err != OK) {
-        pm_free(hinavm_paddr, hinavm_size);
+        slab_free(&hinavm_cache, hinavm);
+        free_task(task);
         return err;
     }
 
-    pm_own_page(hinavm_paddr, task);
+    task->hinavm = hinavm;
     list_push_back(&active_tasks, &task->next);
     task_resume(task);
     TRACE("created a HinaVM task \"%s\" (tid=%d)", name, tid);
     return tid;
 }
 
+// スレッドを作成する。taskと同じアドレス空間・ページャータスクを共有し、ipから実行を開始
+// する。spはユーザースタックの初期値、argはa0レジスタ (第1引数) に渡される値。
+task_t thread_create(struct task *task, uaddr_t ip, uaddr_t sp, uaddr_t arg) {
+    struct task *leader = task->leader;
+    error_t err;
+    struct task *thread = alloc_task(&err);
+    if (!thread) {
+        return err;
+    }
+
+    task_t tid = thread->tid;
+    err = init_task_struct(thread, leader, tid, leader->name, ip, sp,
+                           leader->pager, 0, (void *) arg);
+    if (err != OK) {
+        free_task(thread);
+        return err;
+    }
+
+    // 優先度とアフィニティは作成元のスレッドから引き継ぐ
+    thread->priority = task->priority;
+    thread->affinity = task->affinity;
+
+    list_push_back(&leader->threads, &thread->thread_next);
+    list_push_back(&active_tasks, &thread->next);
+    task_resume(thread);
+    TRACE("created a thread of \"%s\" (tid=%d)", leader->name, tid);
+    return tid;
+}
+
+// タスク (またはスレッド) をカーネルから削除する。スレッドの場合は、アドレス空間と
+// メモリページはリーダーのものなので解放しない。
+static void destroy_task(struct task *task) {
+    // 削除中であること記録しておくことで、以下のプロセッサ間割り込みを受け取った他のCPUでの
+    // スケジューラが再びこのタスクを選ばないようにする。こうしておかないと、もしこのタスク以外
+    // に実行可能なタスクが存在しない場合に以下のループが永久に実行される恐れがある。
+    task->destroyed = true;
+
+    // 他のCPUがこのタスクの実行を中断するまで待つ。
+    while (true) {
+        // タスクがブロックされていれば明らかに現在実行中ではない。ただし、受信待ちで
+        // スピン中の場合は他のCPUで実行中である。
+        if (task->state != TASK_RUNNABLE && !task->spinning) {
+            break;
+        }
+
+        // タスクが実行可能状態であってもいずれかのCPUのランキューに含まれていれば現在
+        // 実行中ではない。
+        if (list_is_linked(&task->waitqueue_next)) {
+            break;
+        }
+
+        // 他のCPUがこのタスクを実行中である。IPIを送信してコンテキストスイッチを促す。
+        arch_send_ipi(IPI_RESCHEDULE);
+    }
+
+    // もしこのタスクへメッセージを送ろうとしているタスクがいたら、それらの送信処理を中断させる。
+    for (int i = 0; i < IPC_PORTS_MAX; i++) {
+        LIST_FOR_EACH (sender, &task->senders[i], struct task, waitqueue_next) {
+            list_remove(&sender->waitqueue_next);
+            notify(sender, NOTIFY_ABORTED);
+            task_resume(sender);
+        }
+    }
+
+    // このタスクが他のスレッドの終了を待っていた場合は、その参照を消す
+    struct task *leader = task->leader;
+    LIST_FOR_EACH (thread, &leader->threads, struct task, thread_next) {
+        if (thread->joiner == task) {
+            thread->joiner = NULL;
+        }
+    }
+
+    // カーネルからタスクを削除する。
+    list_remove(&task->next);
+    list_remove(&task->waitqueue_next);
+    list_remove(&task->thread_next);
+    if (leader == task) {
+        arch_vm_destroy(&task->vm);
+    }
+
+    arch_task_destroy(task);
+    for (int i = 0; i < TASK_TIMERS_MAX; i++) {
+        timer_cancel(&task->timers[i].timer);
+    }
+
+    timer_cancel(&task->ipc_timer);
+    if (leader == task) {
+        pm_free_by_list(&task->pages);
+    }
+
+    ipc_cleanup(task);
+    if (task->pager) {
+        task->pager->ref_count--;
+    }
+
+    if (task->hinavm) {
+        slab_free(&hinavm_cache, task->hinavm);
+    }
+
+    free_task(task);
+}
+
 // タスクを削除する。taskは削除するタスク。taskが実行中のタスクである場合は、この関数では
-// なく、task_exit関数を呼び出す必要がある。
+// なく、task_exit関数を呼び出す必要がある。taskのスレッドも全て削除される。
 error_t task_destroy(struct task *task) {
     DEBUG_ASSERT(task != CURRENT_TASK);
     DEBUG_ASSERT(task != IDLE_TASK);
     DEBUG_ASSERT(task->state != TASK_UNUSED);
     DEBUG_ASSERT(task->ref_count >= 0);
+    DEBUG_ASSERT(task->leader == task);
 
     if (task->tid == 1) {
         // 最初のユーザータスク (VMサーバ) は削除できない。
@@ -216,45 +702,81 @@ error_t task_destroy(struct task *task) {
 
     TRACE("destroying a task \"%s\" (tid=%d)", task->name, task->tid);
 
-    // 削除中であること記録しておくことで、以下のプロセッサ間割り込みを受け取った他のCPUでの
-    // スケジューラが再びこのタスクを選ばないようにする。こうしておかないと、もしこのタスク以外
-    // に実行可能なタスクが存在しない場合に以下のループが永久に実行される恐れがある。
+    // 先に全スレッドを削除中として印を付けておき、スレッドを1つずつ削除している間に
+    // 他のスレッドが再びスケジュールされないようにする。
     task->destroyed = true;
+    LIST_FOR_EACH (thread, &task->threads, struct task, thread_next) {
+        thread->destroyed = true;
+    }
 
-    // 他のCPUがこのタスクの実行を中断するまで待つ。
     while (true) {
-        // タスクがブロックされていれば明らかに現在実行中ではない。
-        if (task->state != TASK_RUNNABLE) {
+        struct task *thread =
+            LIST_POP_FRONT(&task->threads, struct task, thread_next);
+        if (!thread) {
             break;
         }
 
-        // タスクが実行可能状態であってもランキューに含まれていなければ現在実行中ではない。
-        if (list_contains(&runqueue, &task->waitqueue_next)) {
-            break;
-        }
+        destroy_task(thread);
+    }
 
-        // 他のCPUがこのタスクを実行中である。IPIを送信してコンテキストスイッチを促す。
-        arch_send_ipi(IPI_RESCHEDULE);
+    destroy_task(task);
+    return OK;
+}
+
+// スレッドの終了を待ち、終了したスレッドを削除する。tidは実行中タスクと同じアドレス空間の
+// スレッド (リーダー以外) でなければならない。
+error_t thread_join(task_t tid) {
+    struct task *current = CURRENT_TASK;
+    struct task *thread = task_find(tid);
+    if (!thread || thread == current || thread->leader == thread
+        || thread->leader != current->leader) {
+        return ERR_INVALID_TASK;
     }
 
-    // もしこのタスクへメッセージを送ろうとしているタスクがいたら、それらの送信処理を中断させる。
-    LIST_FOR_EACH (sender, &task->senders, struct task, waitqueue_next) {
-        notify(sender, NOTIFY_ABORTED);
+    if (thread->destroyed) {
+        // タスク全体が削除されている途中
+        return ERR_ABORTED;
     }
 
-    // カーネルからタスクを削除する。
-    list_remove(&task->next);
-    list_remove(&task->waitqueue_next);
-    arch_vm_destroy(&task->vm);
-    arch_task_destroy(task);
-    pm_free_by_list(&task->pages);
-    task->state = TASK_UNUSED;
-    task->pager->ref_count--;
+    if (thread->joiner) {
+        // 既に他のスレッドが終了を待っている
+        return ERR_ALREADY_EXISTS;
+    }
+
+    while (!thread->exited) {
+        // スレッドが終了すると再開される
+        thread->joiner = current;
+        task_block(current);
+        task_switch();
+
+        if (task_find(tid) != thread || thread->destroyed) {
+            // 待っている間にタスク全体が削除された
+            return ERR_ABORTED;
+        }
+    }
+
+    destroy_task(thread);
     return OK;
 }
 
 // 実行中タスク (CURRENT_TASK) を終了させる。引数exceptionは終了理由。
 __noreturn void task_exit(int exception) {
+    struct task *current = CURRENT_TASK;
+    if (current->leader != current && exception == EXP_GRACE_EXIT) {
+        // スレッドの正常終了。thread_join関数で削除されるまでブロックしておく。
+        TRACE("exiting a thread \"%s\" (tid=%d)", current->name,
+              current->tid);
+        current->exited = true;
+        if (current->joiner) {
+            task_resume(current->joiner);
+            current->joiner = NULL;
+        }
+
+        task_block(current);
+        task_switch();
+        UNREACHABLE();
+    }
+
     struct task *pager = CURRENT_TASK->pager;
     ASSERT(pager != NULL);
 
@@ -262,13 +784,14 @@ __noreturn void task_exit(int exception) {
           CURRENT_TASK->tid);
 
     // ページャータスクに終了理由を通知する。ページャータスクがtask_destroyシステムコールを
-    // 呼び出すことで、このタスクが実際に削除される。
+    // 呼び出すことで、このタスクが実際に削除される。スレッドが例外で終了した場合は、
+    // そのスレッドを含むタスク全体を削除してもらう。
     struct message m;
     m.type = EXCEPTION_MSG;
-    m.exception.task = CURRENT_TASK->tid;
+    m.exception.task = CURRENT_TASK->leader->tid;
     m.exception.reason = exception;
     error_t err = ipc(CURRENT_TASK->pager, IPC_DENY,
-                      (__user struct message *) &m, IPC_SEND | IPC_KERNEL);
+                      (__user struct message *) &m, IPC_SEND | IPC_KERNEL, 0);
 
     if (err != OK) {
         WARN("%s: failed to send an exit message to '%s': %s",
@@ -289,11 +812,15 @@ void task_dump(void) {
     LIST_FOR_EACH (task, &active_tasks, struct task, next) {
         switch (task->state) {
             case TASK_RUNNABLE:
-                WARN("  #%d: %s: RUNNABLE", task->tid, task->name);
-                LIST_FOR_EACH (sender, &task->senders, struct task,
-                               waitqueue_next) {
-                    WARN("    blocked sender: #%d: %s", sender->tid,
-                         sender->name);
+                WARN("  #%d: %s: RUNNABLE (CPU #%d, priority %d, affinity %x)",
+                     task->tid, task->name, task->cpu, task->priority,
+                     task->affinity);
+                for (int i = 0; i < IPC_PORTS_MAX; i++) {
+                    LIST_FOR_EACH (sender, &task->senders[i], struct task,
+                                   waitqueue_next) {
+                        WARN("    blocked sender: #%d: %s (port %d)",
+                             sender->tid, sender->name, i);
+                    }
                 }
                 break;
             case TASK_BLOCKED:
@@ -316,13 +843,25 @@ void task_dump(void) {
                 UNREACHABLE();
         }
     }
+
+    ipc_dump();
+    pm_dump();
+    slab_dump();
+    spinlock_dump();
 }
 
 // タスク管理システムの初期化
 void task_init_percpu(void) {
     // CPUごとのアイドルタスクを作成し、それを実行中タスクとする。
     struct task *idle_task = &idle_tasks[CPUVAR->id];
-    ASSERT_OK(init_task_struct(idle_task, 0, "(idle)", 0, NULL, 0, NULL));
+    ASSERT_OK(
+        init_task_struct(idle_task, NULL, 0, "(idle)", 0, 0, NULL, 0, NULL));
     IDLE_TASK = idle_task;
     CURRENT_TASK = IDLE_TASK;
+
+    struct runqueue *rq = &CPUVAR->runqueue;
+    rq->bitmap = 0;
+    for (int i = 0; i < NUM_TASK_PRIORITIES; i++) {
+        list_init(&rq->queues[i]);
+    }
 }
@@ -2,6 +2,7 @@
 #include "arch.h"
 #include "hinavm.h"
 #include "interrupt.h"
+#include "ipc.h"
 #include <libs/common/list.h>
 #include <libs/common/message.h>
 #include <libs/common/types.h>
@@ -14,6 +15,23 @@
 // 実行中タスク (struct task *)
 #define CURRENT_TASK (arch_cpuvar_get()->current_task)
 
+// ランキューのビットマップ (uint32_t) で全ての優先度を表せるようにする
+STATIC_ASSERT(NUM_TASK_PRIORITIES <= 32, "too many task priorities");
+// CPUアフィニティのビットマップ (uint32_t) で全てのCPUを表せるようにする
+STATIC_ASSERT(NUM_CPUS_MAX <= 32, "too many CPUs");
+
+// タスク番号をタスクIDの下位ビット (TASK_INDEX_BITS) で表せるようにする
+STATIC_ASSERT(NUM_TASKS_MAX <= TASK_INDEX_MASK, "too many tasks");
+
+// 存在しうる全てのCPUのビットマップ
+#define ALL_CPUS_MASK ((uint32_t) ((1ULL << NUM_CPUS_MAX) - 1))
+
+// タスクのタイマー (timeシステムコール)
+struct task_timer {
+    struct timer timer;  // タイマー
+    struct task *task;   // タイマーを設定したタスク
+};
+
 // タスクの状態
 #define TASK_UNUSED   0
 #define TASK_RUNNABLE 1
@@ -28,15 +46,41 @@ struct task {
     int state;                      // タスクの状態
     bool destroyed;                 // タスクが削除されている途中かどうか
     struct task *pager;             // ページャータスク
-    unsigned timeout;               // タイムアウトの残り時間
+    struct task *leader;            // アドレス空間を所有するタスク
+                                    // (スレッドでなければ自身)
+    list_t threads;                 // スレッドのリスト (leaderのみ使用)
+    list_elem_t thread_next;        // スレッドのリストの次の要素へのポインタ
+    struct task *joiner;            // このスレッドの終了を待っているスレッド
+    bool exited;                    // スレッドが終了したかどうか
+    struct hinavm *hinavm;          // HinaVMの命令列 (HinaVMタスクでなければNULL)
+    // タイムアウト通知 (sys_time) 用のタイマー
+    struct task_timer timers[TASK_TIMERS_MAX];
+    uint32_t timers_fired;          // タイムアウトしたタイマーのビットマップ
+    struct timer ipc_timer;         // IPCのタイムアウト用のタイマー
+    bool ipc_timed_out;             // IPCがタイムアウトしたかどうか
+    bool spinning;                  // 受信待ちでスピン中かどうか
+    int spin_budget;                // 受信待ちでスピンする回数
     int ref_count;                  // タスクが参照されている数 (ゼロでないと削除不可)
     unsigned quantum;               // タスクの残りクォンタム
+    int priority;                   // タスクの優先度 (小さいほど優先度が高い)
+    int cpu;                        // 最後に実行された (または実行待ちの) CPUのID
+    uint32_t affinity;              // 実行してよいCPUのビットマップ
     list_elem_t waitqueue_next;     // 各種待ちリストの次の要素へのポインタ
-    list_elem_t next;               // 全タスクリストの次の要素へのポインタ
-    list_t senders;                 // このタスクへの送信待ちタスクリスト
+    list_elem_t next;               // 全タスクリスト (未使用の場合は空きリスト)
+                                    // の次の要素へのポインタ
+    list_t senders[IPC_PORTS_MAX];  // このタスクの各ポートへの送信待ちタスクリスト
     task_t wait_for;                // このタスクへメッセージ送信ができるタスクID
                                     // (IPC_ANYの場合は全て)
+    unsigned wait_ports;            // 受信待ちしているポートの集合 (ビットマップ)
+    struct task *send_to;           // 送信待ちしている宛先タスク (NULLの場合はなし)
+    unsigned send_port;             // 送信待ちしている宛先タスクのポート
+    task_t handoff;                 // 次に受信待ちでブロックする際にCPUを直接譲る
+                                    // タスクID (0の場合はなし)
+    uaddr_t ool_window;             // ページ単位のバッファ (ool) の受信先アドレス
+                                    // (受信待ち中のみ有効。0の場合は受け取らない)
     list_t pages;                   // 利用中メモリページのリスト
+    list_t async_messages;          // 非同期メッセージの受信キュー
+    unsigned num_async_messages;    // 受信キュー内の非同期メッセージの数
     notifications_t notifications;  // 受信済みの通知
     struct message m;               // メッセージの一時保存領域
 };
@@ -44,13 +88,20 @@ struct task {
 extern list_t active_tasks;
 
 struct task *task_find(task_t tid);
+struct task *task_find_by_index(unsigned index);
 task_t task_create(const char *name, uaddr_t ip, struct task *pager);
 task_t hinavm_create(const char *name, hinavm_inst_t *insts, uint32_t num_insts,
                      struct task *pager);
 error_t task_destroy(struct task *task);
 __noreturn void task_exit(int exception);
+task_t thread_create(struct task *task, uaddr_t ip, uaddr_t sp, uaddr_t arg);
+error_t thread_join(task_t tid);
 void task_resume(struct task *task);
 void task_block(struct task *task);
 void task_switch(void);
+bool task_switch_to(struct task *next);
+void task_preempt(void);
+error_t task_set_priority(struct task *task, int priority);
+error_t task_set_affinity(struct task *task, uint32_t affinity);
 void task_dump(void);
 void task_init_percpu(void);
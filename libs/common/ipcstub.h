@@ -18,6 +18,7 @@ struct exception_fields {
 
 struct page_fault_fields {
     task_t task;
+    task_t thread;
     uaddr_t uaddr;
     uaddr_t ip;
     unsigned fault;
@@ -27,17 +28,14 @@ struct page_fault_reply_fields {
 
 struct notify_fields {
     notifications_t notifications;
+    uint32_t timers;
 };
 
 struct notify_irq_fields {
 };
 
 struct notify_timer_fields {
-};
-
-struct async_recv_fields {
-};
-struct async_recv_reply_fields {
+    uint32_t timers;
 };
 
 struct ping_fields {
@@ -103,21 +101,21 @@ struct vm_alloc_physical_reply_fields {
 
 struct blk_read_fields {
     unsigned sector;
-    size_t offset;
     size_t len;
 };
 struct blk_read_reply_fields {
-    uint8_t data[1024];
+    uaddr_t data;
     size_t data_len;
 };
 
 struct blk_write_fields {
     unsigned sector;
-    size_t offset;
-    uint8_t data[1024];
+    uaddr_t data;
     size_t data_len;
 };
 struct blk_write_reply_fields {
+    uaddr_t data;
+    size_t data_len;
 };
 
 struct net_open_fields {
@@ -127,13 +125,13 @@ struct net_open_reply_fields {
 };
 
 struct net_recv_fields {
-    uint8_t payload[1500];
     size_t payload_len;
+    uint8_t payload[1500];
 };
 
 struct net_send_fields {
-    uint8_t payload[1500];
     size_t payload_len;
+    uint8_t payload[1500];
 };
 struct net_send_reply_fields {
 };
@@ -155,16 +153,18 @@ struct fs_close_reply_fields {
 struct fs_read_fields {
     int fd;
     size_t len;
+    uaddr_t buf;
+    size_t buf_len;
 };
 struct fs_read_reply_fields {
-    uint8_t data[1024];
+    uaddr_t data;
     size_t data_len;
 };
 
 struct fs_write_fields {
     int fd;
-    uint8_t data[1024];
     size_t data_len;
+    uint8_t data[1024];
 };
 struct fs_write_reply_fields {
     size_t written_len;
@@ -214,8 +214,8 @@ struct tcpip_close_reply_fields {
 
 struct tcpip_write_fields {
     int sock;
-    uint8_t data[1024];
     size_t data_len;
+    uint8_t data[1024];
 };
 struct tcpip_write_reply_fields {
 };
@@ -224,8 +224,8 @@ struct tcpip_read_fields {
     int sock;
 };
 struct tcpip_read_reply_fields {
-    uint8_t data[1024];
     size_t data_len;
+    uint8_t data[1024];
 };
 
 struct tcpip_dns_resolve_fields {
@@ -251,62 +251,60 @@ struct tcpip_closed_fields {
 #define NOTIFY_MSG 4
 #define NOTIFY_IRQ_MSG 5
 #define NOTIFY_TIMER_MSG 6
-#define ASYNC_RECV_MSG 7
-#define ASYNC_RECV_REPLY_MSG 8
-#define PING_MSG 9
-#define PING_REPLY_MSG 10
-#define SPAWN_TASK_MSG 11
-#define SPAWN_TASK_REPLY_MSG 12
-#define DESTROY_TASK_MSG 13
-#define DESTROY_TASK_REPLY_MSG 14
-#define SERVICE_LOOKUP_MSG 15
-#define SERVICE_LOOKUP_REPLY_MSG 16
-#define SERVICE_REGISTER_MSG 17
-#define SERVICE_REGISTER_REPLY_MSG 18
-#define WATCH_TASKS_MSG 19
-#define WATCH_TASKS_REPLY_MSG 20
-#define TASK_DESTROYED_MSG 21
-#define VM_MAP_PHYSICAL_MSG 22
-#define VM_MAP_PHYSICAL_REPLY_MSG 23
-#define VM_ALLOC_PHYSICAL_MSG 24
-#define VM_ALLOC_PHYSICAL_REPLY_MSG 25
-#define BLK_READ_MSG 26
-#define BLK_READ_REPLY_MSG 27
-#define BLK_WRITE_MSG 28
-#define BLK_WRITE_REPLY_MSG 29
-#define NET_OPEN_MSG 30
-#define NET_OPEN_REPLY_MSG 31
-#define NET_RECV_MSG 32
-#define NET_SEND_MSG 33
-#define NET_SEND_REPLY_MSG 34
-#define FS_OPEN_MSG 35
-#define FS_OPEN_REPLY_MSG 36
-#define FS_CLOSE_MSG 37
-#define FS_CLOSE_REPLY_MSG 38
-#define FS_READ_MSG 39
-#define FS_READ_REPLY_MSG 40
-#define FS_WRITE_MSG 41
-#define FS_WRITE_REPLY_MSG 42
-#define FS_READDIR_MSG 43
-#define FS_READDIR_REPLY_MSG 44
-#define FS_MKFILE_MSG 45
-#define FS_MKFILE_REPLY_MSG 46
-#define FS_MKDIR_MSG 47
-#define FS_MKDIR_REPLY_MSG 48
-#define FS_DELETE_MSG 49
-#define FS_DELETE_REPLY_MSG 50
-#define TCPIP_CONNECT_MSG 51
-#define TCPIP_CONNECT_REPLY_MSG 52
-#define TCPIP_CLOSE_MSG 53
-#define TCPIP_CLOSE_REPLY_MSG 54
-#define TCPIP_WRITE_MSG 55
-#define TCPIP_WRITE_REPLY_MSG 56
-#define TCPIP_READ_MSG 57
-#define TCPIP_READ_REPLY_MSG 58
-#define TCPIP_DNS_RESOLVE_MSG 59
-#define TCPIP_DNS_RESOLVE_REPLY_MSG 60
-#define TCPIP_DATA_MSG 61
-#define TCPIP_CLOSED_MSG 62
+#define PING_MSG 7
+#define PING_REPLY_MSG 8
+#define SPAWN_TASK_MSG 9
+#define SPAWN_TASK_REPLY_MSG 10
+#define DESTROY_TASK_MSG 11
+#define DESTROY_TASK_REPLY_MSG 12
+#define SERVICE_LOOKUP_MSG 13
+#define SERVICE_LOOKUP_REPLY_MSG 14
+#define SERVICE_REGISTER_MSG 15
+#define SERVICE_REGISTER_REPLY_MSG 16
+#define WATCH_TASKS_MSG 17
+#define WATCH_TASKS_REPLY_MSG 18
+#define TASK_DESTROYED_MSG 19
+#define VM_MAP_PHYSICAL_MSG 20
+#define VM_MAP_PHYSICAL_REPLY_MSG 21
+#define VM_ALLOC_PHYSICAL_MSG 22
+#define VM_ALLOC_PHYSICAL_REPLY_MSG 23
+#define BLK_READ_MSG 24
+#define BLK_READ_REPLY_MSG 25
+#define BLK_WRITE_MSG 26
+#define BLK_WRITE_REPLY_MSG 27
+#define NET_OPEN_MSG 28
+#define NET_OPEN_REPLY_MSG 29
+#define NET_RECV_MSG 30
+#define NET_SEND_MSG 31
+#define NET_SEND_REPLY_MSG 32
+#define FS_OPEN_MSG 33
+#define FS_OPEN_REPLY_MSG 34
+#define FS_CLOSE_MSG 35
+#define FS_CLOSE_REPLY_MSG 36
+#define FS_READ_MSG 37
+#define FS_READ_REPLY_MSG 38
+#define FS_WRITE_MSG 39
+#define FS_WRITE_REPLY_MSG 40
+#define FS_READDIR_MSG 41
+#define FS_READDIR_REPLY_MSG 42
+#define FS_MKFILE_MSG 43
+#define FS_MKFILE_REPLY_MSG 44
+#define FS_MKDIR_MSG 45
+#define FS_MKDIR_REPLY_MSG 46
+#define FS_DELETE_MSG 47
+#define FS_DELETE_REPLY_MSG 48
+#define TCPIP_CONNECT_MSG 49
+#define TCPIP_CONNECT_REPLY_MSG 50
+#define TCPIP_CLOSE_MSG 51
+#define TCPIP_CLOSE_REPLY_MSG 52
+#define TCPIP_WRITE_MSG 53
+#define TCPIP_WRITE_REPLY_MSG 54
+#define TCPIP_READ_MSG 55
+#define TCPIP_READ_REPLY_MSG 56
+#define TCPIP_DNS_RESOLVE_MSG 57
+#define TCPIP_DNS_RESOLVE_REPLY_MSG 58
+#define TCPIP_DATA_MSG 59
+#define TCPIP_CLOSED_MSG 60
 
 //
 //  各種マクロの定義
@@ -318,8 +316,6 @@ struct tcpip_closed_fields {
     struct notify_fields notify; \
     struct notify_irq_fields notify_irq; \
     struct notify_timer_fields notify_timer; \
-    struct async_recv_fields async_recv; \
-    struct async_recv_reply_fields async_recv_reply; \
     struct ping_fields ping; \
     struct ping_reply_fields ping_reply; \
     struct spawn_task_fields spawn_task; \
@@ -375,7 +371,7 @@ struct tcpip_closed_fields {
     struct tcpip_data_fields tcpip_data; \
     struct tcpip_closed_fields tcpip_closed; \
 
-#define IPCSTUB_MSGID_MAX 62
+#define IPCSTUB_MSGID_MAX 60
 #define IPCSTUB_MSGID2STR \
     (const char *[]){ \
      \
@@ -390,91 +386,187 @@ struct tcpip_closed_fields {
      \
         [6] = "notify_timer", \
      \
-        [7] = "async_recv", \
-        [8] = "async_recv_reply", \
+        [7] = "ping", \
+        [8] = "ping_reply", \
+     \
+        [9] = "spawn_task", \
+        [10] = "spawn_task_reply", \
+     \
+        [11] = "destroy_task", \
+        [12] = "destroy_task_reply", \
+     \
+        [13] = "service_lookup", \
+        [14] = "service_lookup_reply", \
+     \
+        [15] = "service_register", \
+        [16] = "service_register_reply", \
+     \
+        [17] = "watch_tasks", \
+        [18] = "watch_tasks_reply", \
      \
-        [9] = "ping", \
-        [10] = "ping_reply", \
+        [19] = "task_destroyed", \
      \
-        [11] = "spawn_task", \
-        [12] = "spawn_task_reply", \
+        [20] = "vm_map_physical", \
+        [21] = "vm_map_physical_reply", \
      \
-        [13] = "destroy_task", \
-        [14] = "destroy_task_reply", \
+        [22] = "vm_alloc_physical", \
+        [23] = "vm_alloc_physical_reply", \
      \
-        [15] = "service_lookup", \
-        [16] = "service_lookup_reply", \
+        [24] = "blk_read", \
+        [25] = "blk_read_reply", \
      \
-        [17] = "service_register", \
-        [18] = "service_register_reply", \
+        [26] = "blk_write", \
+        [27] = "blk_write_reply", \
      \
-        [19] = "watch_tasks", \
-        [20] = "watch_tasks_reply", \
+        [28] = "net_open", \
+        [29] = "net_open_reply", \
      \
-        [21] = "task_destroyed", \
+        [30] = "net_recv", \
      \
-        [22] = "vm_map_physical", \
-        [23] = "vm_map_physical_reply", \
+        [31] = "net_send", \
+        [32] = "net_send_reply", \
      \
-        [24] = "vm_alloc_physical", \
-        [25] = "vm_alloc_physical_reply", \
+        [33] = "fs_open", \
+        [34] = "fs_open_reply", \
      \
-        [26] = "blk_read", \
-        [27] = "blk_read_reply", \
+        [35] = "fs_close", \
+        [36] = "fs_close_reply", \
      \
-        [28] = "blk_write", \
-        [29] = "blk_write_reply", \
+        [37] = "fs_read", \
+        [38] = "fs_read_reply", \
      \
-        [30] = "net_open", \
-        [31] = "net_open_reply", \
+        [39] = "fs_write", \
+        [40] = "fs_write_reply", \
      \
-        [32] = "net_recv", \
+        [41] = "fs_readdir", \
+        [42] = "fs_readdir_reply", \
      \
-        [33] = "net_send", \
-        [34] = "net_send_reply", \
+        [43] = "fs_mkfile", \
+        [44] = "fs_mkfile_reply", \
      \
-        [35] = "fs_open", \
-        [36] = "fs_open_reply", \
+        [45] = "fs_mkdir", \
+        [46] = "fs_mkdir_reply", \
      \
-        [37] = "fs_close", \
-        [38] = "fs_close_reply", \
+        [47] = "fs_delete", \
+        [48] = "fs_delete_reply", \
      \
-        [39] = "fs_read", \
-        [40] = "fs_read_reply", \
+        [49] = "tcpip_connect", \
+        [50] = "tcpip_connect_reply", \
      \
-        [41] = "fs_write", \
-        [42] = "fs_write_reply", \
+        [51] = "tcpip_close", \
+        [52] = "tcpip_close_reply", \
      \
-        [43] = "fs_readdir", \
-        [44] = "fs_readdir_reply", \
+        [53] = "tcpip_write", \
+        [54] = "tcpip_write_reply", \
+     \
+        [55] = "tcpip_read", \
+        [56] = "tcpip_read_reply", \
+     \
+        [57] = "tcpip_dns_resolve", \
+        [58] = "tcpip_dns_resolve_reply", \
+     \
+        [59] = "tcpip_data", \
+     \
+        [60] = "tcpip_closed", \
+     \
+    }
+
+#define IPCSTUB_MSG_LAYOUTS \
+    { \
      \
-        [45] = "fs_mkfile", \
-        [46] = "fs_mkfile_reply", \
+        [1] = { sizeof(struct exception_fields), 0, 0, 0, 0, 0 }, \
      \
-        [47] = "fs_mkdir", \
-        [48] = "fs_mkdir_reply", \
+        [2] = { sizeof(struct page_fault_fields), 0, 0, 0, 0, 0 }, \
+        [3] = { sizeof(struct page_fault_reply_fields), 0, 0, 0, 0, 0 }, \
      \
-        [49] = "fs_delete", \
-        [50] = "fs_delete_reply", \
+        [4] = { sizeof(struct notify_fields), 0, 0, 0, 0, 0 }, \
      \
-        [51] = "tcpip_connect", \
-        [52] = "tcpip_connect_reply", \
+        [5] = { sizeof(struct notify_irq_fields), 0, 0, 0, 0, 0 }, \
      \
-        [53] = "tcpip_close", \
-        [54] = "tcpip_close_reply", \
+        [6] = { sizeof(struct notify_timer_fields), 0, 0, 0, 0, 0 }, \
      \
-        [55] = "tcpip_write", \
-        [56] = "tcpip_write_reply", \
+        [7] = { sizeof(struct ping_fields), 0, 0, 0, 0, 0 }, \
+        [8] = { sizeof(struct ping_reply_fields), 0, 0, 0, 0, 0 }, \
      \
-        [57] = "tcpip_read", \
-        [58] = "tcpip_read_reply", \
+        [9] = { sizeof(struct spawn_task_fields), 0, 0, 0, 0, 0 }, \
+        [10] = { sizeof(struct spawn_task_reply_fields), 0, 0, 0, 0, 0 }, \
      \
-        [59] = "tcpip_dns_resolve", \
-        [60] = "tcpip_dns_resolve_reply", \
+        [11] = { sizeof(struct destroy_task_fields), 0, 0, 0, 0, 0 }, \
+        [12] = { sizeof(struct destroy_task_reply_fields), 0, 0, 0, 0, 0 }, \
      \
-        [61] = "tcpip_data", \
+        [13] = { sizeof(struct service_lookup_fields), 0, 0, 0, 0, 0 }, \
+        [14] = { sizeof(struct service_lookup_reply_fields), 0, 0, 0, 0, 0 }, \
      \
-        [62] = "tcpip_closed", \
+        [15] = { sizeof(struct service_register_fields), 0, 0, 0, 0, 0 }, \
+        [16] = { sizeof(struct service_register_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [17] = { sizeof(struct watch_tasks_fields), 0, 0, 0, 0, 0 }, \
+        [18] = { sizeof(struct watch_tasks_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [19] = { sizeof(struct task_destroyed_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [20] = { sizeof(struct vm_map_physical_fields), 0, 0, 0, 0, 0 }, \
+        [21] = { sizeof(struct vm_map_physical_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [22] = { sizeof(struct vm_alloc_physical_fields), 0, 0, 0, 0, 0 }, \
+        [23] = { sizeof(struct vm_alloc_physical_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [24] = { sizeof(struct blk_read_fields), 0, 0, 0, 0, 0 }, \
+        [25] = { sizeof(struct blk_read_reply_fields), 0, 0, offsetof(struct blk_read_reply_fields, data), offsetof(struct blk_read_reply_fields, data_len), 4096 }, \
+     \
+        [26] = { sizeof(struct blk_write_fields), 0, 0, offsetof(struct blk_write_fields, data), offsetof(struct blk_write_fields, data_len), 4096 }, \
+        [27] = { sizeof(struct blk_write_reply_fields), 0, 0, offsetof(struct blk_write_reply_fields, data), offsetof(struct blk_write_reply_fields, data_len), 4096 }, \
+     \
+        [28] = { sizeof(struct net_open_fields), 0, 0, 0, 0, 0 }, \
+        [29] = { sizeof(struct net_open_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [30] = { offsetof(struct net_recv_fields, payload), offsetof(struct net_recv_fields, payload_len), 1500, 0, 0, 0 }, \
+     \
+        [31] = { offsetof(struct net_send_fields, payload), offsetof(struct net_send_fields, payload_len), 1500, 0, 0, 0 }, \
+        [32] = { sizeof(struct net_send_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [33] = { sizeof(struct fs_open_fields), 0, 0, 0, 0, 0 }, \
+        [34] = { sizeof(struct fs_open_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [35] = { sizeof(struct fs_close_fields), 0, 0, 0, 0, 0 }, \
+        [36] = { sizeof(struct fs_close_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [37] = { sizeof(struct fs_read_fields), 0, 0, offsetof(struct fs_read_fields, buf), offsetof(struct fs_read_fields, buf_len), 4096 }, \
+        [38] = { sizeof(struct fs_read_reply_fields), 0, 0, offsetof(struct fs_read_reply_fields, data), offsetof(struct fs_read_reply_fields, data_len), 4096 }, \
+     \
+        [39] = { offsetof(struct fs_write_fields, data), offsetof(struct fs_write_fields, data_len), 1024, 0, 0, 0 }, \
+        [40] = { sizeof(struct fs_write_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [41] = { sizeof(struct fs_readdir_fields), 0, 0, 0, 0, 0 }, \
+        [42] = { sizeof(struct fs_readdir_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [43] = { sizeof(struct fs_mkfile_fields), 0, 0, 0, 0, 0 }, \
+        [44] = { sizeof(struct fs_mkfile_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [45] = { sizeof(struct fs_mkdir_fields), 0, 0, 0, 0, 0 }, \
+        [46] = { sizeof(struct fs_mkdir_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [47] = { sizeof(struct fs_delete_fields), 0, 0, 0, 0, 0 }, \
+        [48] = { sizeof(struct fs_delete_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [49] = { sizeof(struct tcpip_connect_fields), 0, 0, 0, 0, 0 }, \
+        [50] = { sizeof(struct tcpip_connect_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [51] = { sizeof(struct tcpip_close_fields), 0, 0, 0, 0, 0 }, \
+        [52] = { sizeof(struct tcpip_close_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [53] = { offsetof(struct tcpip_write_fields, data), offsetof(struct tcpip_write_fields, data_len), 1024, 0, 0, 0 }, \
+        [54] = { sizeof(struct tcpip_write_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [55] = { sizeof(struct tcpip_read_fields), 0, 0, 0, 0, 0 }, \
+        [56] = { offsetof(struct tcpip_read_reply_fields, data), offsetof(struct tcpip_read_reply_fields, data_len), 1024, 0, 0, 0 }, \
+     \
+        [57] = { sizeof(struct tcpip_dns_resolve_fields), 0, 0, 0, 0, 0 }, \
+        [58] = { sizeof(struct tcpip_dns_resolve_reply_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [59] = { sizeof(struct tcpip_data_fields), 0, 0, 0, 0, 0 }, \
+     \
+        [60] = { sizeof(struct tcpip_closed_fields), 0, 0, 0, 0, 0 }, \
      \
     }
 
@@ -503,14 +595,6 @@ struct tcpip_closed_fields {
         sizeof(struct notify_timer_fields) < 4096, \
         "'notify_timer' message is too large, should be less than 4096 bytes" \
     ); \
-    _Static_assert( \
-        sizeof(struct async_recv_fields) < 4096, \
-        "'async_recv' message is too large, should be less than 4096 bytes" \
-    ); \
-    _Static_assert( \
-        sizeof(struct async_recv_reply_fields) < 4096, \
-        "'async_recv_reply' message is too large, should be less than 4096 bytes" \
-    ); \
     _Static_assert( \
         sizeof(struct ping_fields) < 4096, \
         "'ping' message is too large, should be less than 4096 bytes" \
@@ -3,6 +3,9 @@
 // IPCスタブジェネレータが生成するコンパイル時チェック
 IPCSTUB_STATIC_ASSERTIONS
 
+// メッセージの種類ごとのデータ長の情報
+static const struct message_layout layouts[] = IPCSTUB_MSG_LAYOUTS;
+
 // メッセージの種類に対応する名前を返す。デバッグ用。
 const char *msgtype2str(int type) {
     if (type == 0 || type > IPCSTUB_MSGID_MAX) {
@@ -11,3 +14,55 @@ const char *msgtype2str(int type) {
 
     return IPCSTUB_MSGID2STR[type];
 }
+
+// メッセージの種類から、可変長のバイト列を除いたメッセージの長さ (ヘッダを含む) を返す。
+// 可変長のバイト列の長さフィールドはこの範囲に含まれる。
+size_t msg_fixed_len(int type) {
+    if (type < 0) {
+        // エラーメッセージ: ヘッダのみ
+        return MESSAGE_HEADER_LEN;
+    }
+
+    if (type == 0 || type > IPCSTUB_MSGID_MAX) {
+        // 未知のメッセージ: 念のため全体を対象とする
+        return sizeof(struct message);
+    }
+
+    return MESSAGE_HEADER_LEN + layouts[type].fixed_len;
+}
+
+// メッセージの種類と長さフィールドの値から、実際に使われているメッセージの長さ (ヘッダを
+// 含む) を返す。少なくとも msg_fixed_len 関数が返す長さまでは読み込まれている必要がある。
+size_t msg_len(const struct message *m) {
+    size_t len = msg_fixed_len(m->type);
+    if (m->type <= 0 || m->type > IPCSTUB_MSGID_MAX) {
+        return len;
+    }
+
+    const struct message_layout *layout = &layouts[m->type];
+    if (!layout->var_len_max) {
+        return len;
+    }
+
+    // 長さフィールドの値は信頼できないので、最大長で切り詰める。
+    size_t var_len = *(const size_t *) &m->data[layout->var_len_off];
+    return len + MIN(var_len, layout->var_len_max);
+}
+
+// メッセージがページ単位のバッファ (ool) を含む場合は、その先頭アドレスと長さのフィールドへの
+// ポインタ、および最大長を返す。含まない場合はfalseを返す。
+bool msg_ool(struct message *m, uaddr_t **addr, size_t **len, size_t *max_len) {
+    if (m->type <= 0 || m->type > IPCSTUB_MSGID_MAX) {
+        return false;
+    }
+
+    const struct message_layout *layout = &layouts[m->type];
+    if (!layout->ool_len_max) {
+        return false;
+    }
+
+    *addr = (uaddr_t *) &m->data[layout->ool_off];
+    *len = (size_t *) &m->data[layout->ool_len_off];
+    *max_len = layout->ool_len_max;
+    return true;
+}
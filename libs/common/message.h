@@ -8,19 +8,40 @@
 #define IPC_RECV    (1 << 17)
 #define IPC_NOBLOCK (1 << 18)
 #define IPC_KERNEL  (1 << 19)
+#define IPC_REPLY   (1 << 20)
+#define IPC_IOV     (1 << 21)
+#define IPC_ASYNC   (1 << 22)
 #define IPC_CALL    (IPC_SEND | IPC_RECV)
 
-#define NOTIFY_TIMER       (1 << 0)
-#define NOTIFY_IRQ         (1 << 1)
-#define NOTIFY_ABORTED     (1 << 2)
-#define NOTIFY_ASYNC_BASE  3
-#define NOTIFY_ASYNC(tid)  (1 << (NOTIFY_ASYNC_BASE + tid))
-#define NOTIFY_ASYNC_START (NOTIFY_ASYNC(0))
-#define NOTIFY_ASYNC_END   (NOTIFY_ASYNC(NUM_TASKS_MAX))
+// ブロックする際のタイムアウト時間 (ミリ秒)。フラグの下位16ビットに指定する。0の場合は
+// タイムアウトしない。
+#define IPC_TIMEOUT_MAX  0xffff
+#define IPC_TIMEOUT(ms)  ((ms) & IPC_TIMEOUT_MAX)
 
-// 各タスクは専用のASYNC用ビットフィールドをnotification_tに持つ
-STATIC_ASSERT(NOTIFY_ASYNC_BASE + NUM_TASKS_MAX < sizeof(notifications_t) * 8,
-              "too many tasks for notifications_t");
+// ポート (受信口)。各タスクはIPC_PORTS_MAX個のポートを持ち、送信待ちキューはポートごとに
+// 分かれている。送信時はIPC_PORTで宛先タスクのポートを指定し、受信時はIPC_PORTSで受信する
+// ポートの集合 (ビットマップ) を指定する (0の場合は全てのポート)。オープン受信では番号が
+// 大きいポートほど優先して受信する。通知と非同期メッセージはポート0に届く。
+#define IPC_PORTS_MAX     4
+#define IPC_PORT(port)    (((port) &0x3) << 24)
+#define IPC_PORTS(ports)  (((ports) &0xf) << 26)
+#define IPC_GET_PORT(flags)  (((flags) >> 24) & 0x3)
+#define IPC_GET_PORTS(flags) (((flags) >> 26) & 0xf)
+#define IPC_REPLY_RECV (IPC_SEND | IPC_RECV | IPC_REPLY)
+
+#define NOTIFY_TIMER   (1 << 0)
+#define NOTIFY_IRQ     (1 << 1)
+#define NOTIFY_ABORTED (1 << 2)
+
+// メッセージの種類ごとのデータ長の情報。IPCスタブジェネレータが生成する。
+struct message_layout {
+    uint16_t fixed_len;    // 可変長のバイト列を除いたデータ長
+    uint16_t var_len_off;  // 可変長のバイト列の長さフィールド (*_len) のオフセット
+    uint16_t var_len_max;  // 可変長のバイト列の最大長 (0の場合は可変長部分なし)
+    uint16_t ool_off;      // ページ単位のバッファ (ool) の先頭アドレスのオフセット
+    uint16_t ool_len_off;  // ページ単位のバッファ (ool) の長さのオフセット
+    uint16_t ool_len_max;  // ページ単位のバッファ (ool) の最大長 (0の場合はなし)
+};
 
 struct message {
     int32_t type;  // メッセージの種類 (負の数の場合はエラー値)
@@ -40,4 +61,26 @@ struct message {
 STATIC_ASSERT(sizeof(struct message) < 2048,
               "sizeof(struct message) too large");
 
+// メッセージヘッダ (typeとsrc) の長さ
+#define MESSAGE_HEADER_LEN offsetof(struct message, data)
+
+// ベクタIPC (IPC_IOV) で使うバッファの最大数
+#define IPC_IOV_MAX 4
+
+// ベクタIPCのバッファ
+struct ipc_iovec {
+    void *base;  // バッファの先頭アドレス
+    size_t len;  // バッファの長さ
+};
+
+// ベクタIPCのバッファの一覧。IPC_IOVフラグを指定した場合、struct messageの代わりにこの
+// 構造体へのポインタを渡す。各バッファを順に連結したものがメッセージとして扱われる。
+struct ipc_iovs {
+    int num_iovs;                        // バッファの数
+    struct ipc_iovec iovs[IPC_IOV_MAX];  // バッファの一覧
+};
+
 const char *msgtype2str(int type);
+size_t msg_fixed_len(int type);
+size_t msg_len(const struct message *m);
+bool msg_ool(struct message *m, uaddr_t **addr, size_t **len, size_t *max_len);
@@ -14,9 +14,25 @@ int memcmp(const void *p1, const void *p2, size_t len) {
     return (len > 0) ? *s1 - *s2 : 0;
 }
 
-// メモリ領域の各バイトを指定した値で埋める。
+// メモリ領域の各バイトを指定した値で埋める。ページのゼロクリアなど長い領域を埋めることが
+// 多いので、アラインされている部分はワード単位で書き込む。
 void *memset(void *dst, int ch, size_t len) {
     uint8_t *d = dst;
+    while (len > 0 && !IS_ALIGNED((uintptr_t) d, sizeof(uint32_t))) {
+        *d = ch;
+        d++;
+        len--;
+    }
+
+    // 他の型のオブジェクトを書き換えるので、エイリアスを許す型を使う
+    typedef uint32_t __attribute__((may_alias)) word_t;
+    word_t word = (uint8_t) ch * 0x01010101U;
+    while (len >= sizeof(uint32_t)) {
+        *(word_t *) d = word;
+        d += sizeof(uint32_t);
+        len -= sizeof(uint32_t);
+    }
+
     while (len-- > 0) {
         *d = ch;
         d++;
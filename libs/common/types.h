@@ -73,6 +73,8 @@ typedef __builtin_va_list va_list;
 
 // アトミックにポインタの値を読み込む
 #define atomic_load(ptr) __atomic_load_n(ptr, __ATOMIC_SEQ_CST)
+// アトミックにポインタの値に加算 (+=) を行い、加算前の値を返す
+#define atomic_fetch_and_add(ptr, value) __sync_fetch_and_add(ptr, value)
 // アトミックにポインタの値にビット論理和代入 (|=) を行う
 #define atomic_fetch_and_or(ptr, value) __sync_fetch_and_or(ptr, value)
 // アトミックにポインタの値にビット論理積代入 (&=) を行う
@@ -132,7 +134,8 @@ typedef __builtin_va_list va_list;
 #define ERR_NOT_A_FILE      -25                   // ファイルではない
 #define ERR_NOT_A_DIR       -26                   // ディレクトリではない
 #define ERR_EOF             -27                   // ファイル・データの終端
-#define ERR_END             -28                   // 最後のエラーコードでなければならない
+#define ERR_TIMEOUT         -28                   // タイムアウトした
+#define ERR_END             -29                   // 最後のエラーコードでなければならない
 
 // メモリページサイズ
 #define PAGE_SIZE 4096
@@ -148,24 +151,53 @@ typedef __builtin_va_list va_list;
 // VMサーバ (最初のユーザータスク) のタスクID
 #define VM_SERVER 1
 
+// タスクIDの構成。下位ビットがタスク番号 (1からNUM_TASKS_MAXまで)、上位ビットが世代番号。
+// タスク番号は再利用されるが、その度に世代番号が変わるので、削除されたタスクのIDが新しい
+// タスクを指してしまうことはない。
+#define TASK_INDEX_BITS      13
+#define TASK_INDEX_MASK      ((1 << TASK_INDEX_BITS) - 1)
+#define TASK_GENERATION_MASK ((1 << (31 - TASK_INDEX_BITS)) - 1)
+// タスクIDからタスク番号を取り出す
+#define TASK_INDEX(tid) ((tid) & TASK_INDEX_MASK)
+
 // システムコール番号
-#define SYS_IPC          1
-#define SYS_NOTIFY       2
-#define SYS_SERIAL_WRITE 3
-#define SYS_SERIAL_READ  4
-#define SYS_TASK_CREATE  5
-#define SYS_TASK_DESTROY 6
-#define SYS_TASK_EXIT    7
-#define SYS_TASK_SELF    8
-#define SYS_PM_ALLOC     9
-#define SYS_VM_MAP       10
-#define SYS_VM_UNMAP     11
-#define SYS_IRQ_LISTEN   12
-#define SYS_IRQ_UNLISTEN 13
-#define SYS_TIME         14
-#define SYS_UPTIME       15
-#define SYS_HINAVM       16
-#define SYS_SHUTDOWN     17
+#define SYS_IPC           1
+#define SYS_NOTIFY        2
+#define SYS_SERIAL_WRITE  3
+#define SYS_SERIAL_READ   4
+#define SYS_TASK_CREATE   5
+#define SYS_TASK_DESTROY  6
+#define SYS_TASK_EXIT     7
+#define SYS_TASK_SELF     8
+#define SYS_PM_ALLOC      9
+#define SYS_VM_MAP        10
+#define SYS_VM_UNMAP      11
+#define SYS_IRQ_LISTEN    12
+#define SYS_IRQ_UNLISTEN  13
+#define SYS_TIME          14
+#define SYS_UPTIME        15
+#define SYS_HINAVM        16
+#define SYS_SHUTDOWN      17
+#define SYS_TASK_PRIORITY 18
+#define SYS_LOCK_STATS    19
+#define SYS_TASK_AFFINITY 20
+#define SYS_THREAD_CREATE 21
+#define SYS_THREAD_JOIN   22
+
+// タスクの優先度。値が小さいほど優先度が高い。
+#define TASK_PRIORITY_HIGHEST 0
+#define TASK_PRIORITY_LOWEST  31
+#define TASK_PRIORITY_DEFAULT 16
+#define NUM_TASK_PRIORITIES   (TASK_PRIORITY_LOWEST + 1)
+
+// タスクのCPUアフィニティ (実行してよいCPUのビットマップ)。n番目のビットがn番目のCPUを表す。
+#define TASK_AFFINITY_ANY 0xffffffff  // 全てのCPUで実行してよい
+
+// タスクごとに設定できるタイマー (timeシステムコール) の最大数
+#define TASK_TIMERS_MAX 4
+
+// lock_statsシステムコールのフラグ
+#define LOCK_STATS_RESET (1 << 0)  // 表示した後に統計情報をリセットする
 
 // pm_alloc() のフラグ
 #define PM_ALLOC_UNINITIALIZED 0         // ゼロクリアされていなくてもよい
@@ -1,69 +1,60 @@
-#include <libs/common/list.h>
 #include <libs/common/print.h>
 #include <libs/common/string.h>
 #include <libs/user/ipc.h>
-#include <libs/user/malloc.h>
 #include <libs/user/syscall.h>
 #include <libs/user/task.h>
 
-// 非同期メッセージ
-struct async_message {
-    list_elem_t next;  // 送信キューのリスト
-    task_t dst;        // 宛先タスク
-    struct message m;  // メッセージ
-};
-
-// このタスクから他のタスクに向けて送信される非同期メッセージリスト。
-// 他のタスクから問い合わせ (ASYNC_RECV_MSG) があると、このリストからメッセージを探す。
-static list_t async_messages = LIST_INIT(async_messages);
 // 受信済みの通知 (ビットフィールド)。
 static notifications_t pending_notifications = 0;
+// タイムアウトしたタイマーの番号のビットマップ (NOTIFY_TIMER)
+static uint32_t pending_timers = 0;
 
-// ASYNC_RECV_MSGを受信した際の処理 (ノンブロッキング)
-static error_t async_reply(task_t dst) {
-    // 送信キューからdstへの未送信メッセージを探す
-    bool sent = false;
-    LIST_FOR_EACH (am, &async_messages, struct async_message, next) {
-        if (am->dst == dst) {
-            if (sent) {
-                // 既にメッセージを1つ送信済みであればipc_replyが失敗してしまう
-                // (宛先タスクが受信待ち状態でない) ため、通知を送っておいて
-                // 再度ASYNC_RECV_MSGを送らせる。
-                return ipc_notify(dst, NOTIFY_ASYNC(task_self()));
-            }
+// 非同期メッセージを送信する (ノンブロッキング)。メッセージは宛先タスクのカーネル内の
+// 非同期メッセージキューに入り、宛先タスクはオープン受信でそのまま受け取る。キューが一杯の
+// 場合は ERR_TRY_AGAIN を返す。
+error_t ipc_send_async(task_t dst, struct message *m) {
+    return sys_ipc(dst, 0, m, IPC_SEND | IPC_ASYNC, NULL);
+}
 
-            // 未送信メッセージを返信する
-            ipc_reply(dst, &am->m);
-            list_remove(&am->next);
-            free(am);
-            sent = true;
-        }
-    }
+// メッセージを送信する。宛先タスクが受信状態になるまでブロックする。
+error_t ipc_send(task_t dst, struct message *m) {
+    return sys_ipc(dst, 0, m, IPC_SEND, NULL);
+}
 
-    return OK;
+// 複数のバッファを連結したものをメッセージとして送信する (ベクタIPC)。ヘッダとペイロードが
+// 別々の場所にある場合に、一旦1つのメッセージにまとめるコピーを省ける。宛先タスクが受信
+// 状態になるまでブロックする。
+error_t ipc_sendv(task_t dst, const struct ipc_iovec *iovs, int num_iovs) {
+    return ipc_sendv_port(dst, 0, iovs, num_iovs);
 }
 
-// 非同期メッセージを送信する (ノンブロッキング)
-error_t ipc_send_async(task_t dst, struct message *m) {
-    // メッセージを送信キューに挿入する
-    struct async_message *am = malloc(sizeof(*am));
-    am->dst = dst;
-    memcpy(&am->m, m, sizeof(am->m));
-    list_elem_init(&am->next);
-    list_push_back(&async_messages, &am->next);
+// 宛先タスクの指定したポートへメッセージを送信する。宛先タスクがそのポートで受信状態に
+// なるまでブロックする。
+error_t ipc_send_port(task_t dst, unsigned port, struct message *m) {
+    if (port >= IPC_PORTS_MAX) {
+        return ERR_INVALID_ARG;
+    }
 
-    // 送信先タスクに通知を送る
-    return ipc_notify(dst, NOTIFY_ASYNC(task_self()));
+    return sys_ipc(dst, 0, m, IPC_SEND | IPC_PORT(port), NULL);
 }
 
-// メッセージを送信する。宛先タスクが受信状態になるまでブロックする。
-error_t ipc_send(task_t dst, struct message *m) {
-    return sys_ipc(dst, 0, m, IPC_SEND);
+// ipc_sendv関数の宛先ポートを指定するバージョン。
+error_t ipc_sendv_port(task_t dst, unsigned port, const struct ipc_iovec *iovs,
+                       int num_iovs) {
+    struct ipc_iovs desc;
+    if (num_iovs <= 0 || num_iovs > IPC_IOV_MAX || port >= IPC_PORTS_MAX) {
+        return ERR_INVALID_ARG;
+    }
+
+    desc.num_iovs = num_iovs;
+    memcpy(desc.iovs, iovs, sizeof(*iovs) * num_iovs);
+    return sys_ipc(dst, 0, (struct message *) &desc,
+                   IPC_SEND | IPC_IOV | IPC_PORT(port), NULL);
 }
 
 // メッセージを送信する。即座にメッセージ送信を完了できない場合は ERR_WOULD_BLOCK を返す。
 error_t ipc_send_noblock(task_t dst, struct message *m) {
-    return sys_ipc(dst, 0, m, IPC_SEND | IPC_NOBLOCK);
+    return sys_ipc(dst, 0, m, IPC_SEND | IPC_NOBLOCK, NULL);
 }
 
 // メッセージを送信する。即座にメッセージ送信を完了できない場合は警告メッセージを出力し、
@@ -81,8 +72,7 @@ void ipc_reply_err(task_t dst, error_t error) {
     ipc_reply(dst, &m);
 }
 
-// 受信済み通知のひとつを取り出し、メッセージに変換する。また、非同期メッセージの受信処理も
-// 透過的に行う。
+// 受信済み通知のひとつを取り出し、メッセージに変換する。
 static error_t recv_notification_as_message(struct message *m) {
     error_t err;
 
@@ -100,16 +90,10 @@ static error_t recv_notification_as_message(struct message *m) {
         // タイムアウト通知
         case NOTIFY_TIMER:
             m->type = NOTIFY_TIMER_MSG;
+            m->notify_timer.timers = pending_timers;
+            pending_timers = 0;
             err = OK;
             break;
-        // 非同期メッセージ受信通知
-        case NOTIFY_ASYNC_START ... NOTIFY_ASYNC_END: {
-            // 通知の送信元に対して受信待ちメッセージを問い合わせる
-            task_t src = index - NOTIFY_ASYNC_BASE;
-            m->type = ASYNC_RECV_MSG;
-            err = ipc_call(src, m);
-            break;
-        }
         case NOTIFY_ABORTED:
             // カーネル内部で使われる通知なので、ここには来ないはず。
         default:
@@ -122,17 +106,29 @@ static error_t recv_notification_as_message(struct message *m) {
     return err;
 }
 
-// 任意のタスクからのメッセージを受信する (オープン受信)。通知・非同期メッセージパッシング周り
-// の処理も透過的に行う。
-static error_t ipc_recv_any(struct message *m) {
+// 任意のタスクからのメッセージを受信する (オープン受信)。通知周りの処理も透過的に行う。
+// 非同期メッセージはカーネルが通常のメッセージとして配送する。reply_toが0でなければ、受信前にmをそのタスクへ返信する。
+// flagsは受信時に追加で指定するフラグ (IPC_TIMEOUT、IPC_PORTS)。
+static error_t ipc_recv_any(task_t reply_to, struct message *m,
+                            void *ool_window, unsigned flags) {
+    // 通知はポート0に届くので、ポート0を受信しない場合は受信済み通知を返さない。
+    unsigned ports = IPC_GET_PORTS(flags);
+    bool port0 = !ports || (ports & 1);
     while (true) {
         // 受信済み通知があれば、その通知をメッセージに変換して返す。
-        if (pending_notifications) {
+        if (port0 && pending_notifications) {
+            if (reply_to) {
+                ipc_reply(reply_to, m);
+            }
+
             return recv_notification_as_message(m);
         }
 
-        // メッセージを受信する。
-        error_t err = sys_ipc(0, IPC_ANY, m, IPC_RECV);
+        // メッセージを受信する。返信があれば、返信と受信を1回のシステムコールで行う。
+        error_t err =
+            sys_ipc(reply_to, IPC_ANY, m,
+                    (reply_to ? IPC_REPLY_RECV : IPC_RECV) | flags, ool_window);
+        reply_to = 0;
         if (err != OK) {
             return err;
         }
@@ -149,16 +145,12 @@ static error_t ipc_recv_any(struct message *m) {
                 }
 
                 pending_notifications |= m->notify.notifications;
-                return recv_notification_as_message(m);
-            // 非同期メッセージ問い合わせ処理: 送信元タスクへの非同期メッセージがあれば返す。
-            case ASYNC_RECV_MSG: {
-                error_t err = async_reply(m->src);
-                if (err != OK) {
-                    WARN("failed to send a async message to #%d: %s", m->src,
-                         err2str(err));
+                pending_timers |= m->notify.timers;
+                if (!pending_notifications) {
+                    continue;
                 }
-                continue;
-            }
+
+                return recv_notification_as_message(m);
             // その他のメッセージ: エラーでなければそのまま返す。
             default:
                 if (IS_ERROR(m->type)) {
@@ -170,17 +162,81 @@ static error_t ipc_recv_any(struct message *m) {
     }
 }
 
+// ipc_recv関数群の実装。
+static error_t do_recv(task_t src, struct message *m, void *ool_window,
+                       unsigned timeout) {
+    if (src == IPC_ANY) {
+        // オープン受信
+        return ipc_recv_any(0, m, ool_window, IPC_TIMEOUT(timeout));
+    }
+
+    // クローズド受信
+    error_t err =
+        sys_ipc(0, src, m, IPC_RECV | IPC_TIMEOUT(timeout), ool_window);
+    if (err != OK) {
+        return err;
+    }
+
+    // エラーメッセージが返ってくれば、そのエラーを返す。
+    if (IS_ERROR(m->type)) {
+        return m->type;
+    }
+
+    return OK;
+}
+
 // メッセージを受信する。メッセージが届くまでブロックする。
 //
 // src が IPC_ANY の場合は、任意のタスクからのメッセージを受信する (オープン受信)。
 error_t ipc_recv(task_t src, struct message *m) {
-    if (src == IPC_ANY) {
-        // オープン受信
-        return ipc_recv_any(m);
+    return ipc_recv_ool(src, m, NULL);
+}
+
+// 指定したポートの集合 (ビットマップ) のいずれかに届いたメッセージを受信する (オープン
+// 受信)。複数のポートに送信待ちのメッセージがある場合は、番号が大きいポートを優先する。
+error_t ipc_recv_ports(unsigned ports, struct message *m) {
+    if (!ports || ports >= (1U << IPC_PORTS_MAX)) {
+        return ERR_INVALID_ARG;
     }
 
-    // クローズド受信
-    error_t err = sys_ipc(0, src, m, IPC_RECV);
+    return ipc_recv_any(0, m, NULL, IPC_PORTS(ports));
+}
+
+// ipc_recv関数のページ単位のバッファ (ool) を受け取るバージョン。ool_windowはページ境界に
+// アラインされた受信先アドレスで、受信したページはここにマップされる (既存のページは置き
+// 換えられる)。
+error_t ipc_recv_ool(task_t src, struct message *m, void *ool_window) {
+    return do_recv(src, m, ool_window, 0);
+}
+
+// ipc_recv関数のタイムアウト付きバージョン。timeout (ミリ秒) が経過してもメッセージが届か
+// なければ ERR_TIMEOUT を返す。
+error_t ipc_recv_timeout(task_t src, struct message *m, unsigned timeout) {
+    if (timeout > IPC_TIMEOUT_MAX) {
+        return ERR_INVALID_ARG;
+    }
+
+    return do_recv(src, m, NULL, timeout);
+}
+
+// dstへmを返信し、そのまま任意のタスクからのメッセージを受信する (オープン受信)。サーバの
+// メインループで使う。ipc_replyとipc_recvを続けて呼ぶのと同じだが、システムコールは1回で
+// 済む。dstが0の場合は返信せずに受信のみを行う。
+error_t ipc_reply_recv(task_t dst, struct message *m) {
+    return ipc_reply_recv_ool(dst, m, NULL);
+}
+
+// ipc_reply_recv関数のページ単位のバッファ (ool) を受け取るバージョン。ool_windowについては
+// ipc_recv_ool関数を参照。
+error_t ipc_reply_recv_ool(task_t dst, struct message *m, void *ool_window) {
+    return ipc_recv_any(dst, m, ool_window, 0);
+}
+
+// ipc_call関数群の実装。
+static error_t do_call(task_t dst, struct message *m, void *ool_window,
+                       unsigned timeout) {
+    error_t err =
+        sys_ipc(dst, dst, m, IPC_CALL | IPC_TIMEOUT(timeout), ool_window);
     if (err != OK) {
         return err;
     }
@@ -195,12 +251,45 @@ error_t ipc_recv(task_t src, struct message *m) {
 
 // メッセージを送信し、その宛先からのメッセージを待つ。
 error_t ipc_call(task_t dst, struct message *m) {
-    error_t err = sys_ipc(dst, dst, m, IPC_CALL);
+    return ipc_call_ool(dst, m, NULL);
+}
+
+// ipc_call関数のページ単位のバッファ (ool) を受け取るバージョン。ool_windowについては
+// ipc_recv_ool関数を参照。
+error_t ipc_call_ool(task_t dst, struct message *m, void *ool_window) {
+    return do_call(dst, m, ool_window, 0);
+}
+
+// ipc_call関数のタイムアウト付きバージョン。送信・受信のそれぞれで、timeout (ミリ秒) が
+// 経過しても完了しなければ ERR_TIMEOUT を返す。
+error_t ipc_call_timeout(task_t dst, struct message *m, unsigned timeout) {
+    if (timeout > IPC_TIMEOUT_MAX) {
+        return ERR_INVALID_ARG;
+    }
+
+    return do_call(dst, m, NULL, timeout);
+}
+
+// ipc_call関数のベクタIPC版。複数のバッファを連結したものをメッセージとして送信し、返信は
+// 各バッファの先頭から順に分散して受信する。iovs[0]はメッセージヘッダ (typeとsrc) 以上の
+// 長さである必要がある。
+error_t ipc_callv(task_t dst, const struct ipc_iovec *iovs, int num_iovs) {
+    struct ipc_iovs desc;
+    if (num_iovs <= 0 || num_iovs > IPC_IOV_MAX
+        || iovs[0].len < MESSAGE_HEADER_LEN) {
+        return ERR_INVALID_ARG;
+    }
+
+    desc.num_iovs = num_iovs;
+    memcpy(desc.iovs, iovs, sizeof(*iovs) * num_iovs);
+    error_t err =
+        sys_ipc(dst, dst, (struct message *) &desc, IPC_CALL | IPC_IOV, NULL);
     if (err != OK) {
         return err;
     }
 
     // エラーメッセージが返ってくれば、そのエラーを返す。
+    struct message *m = iovs[0].base;
     if (IS_ERROR(m->type)) {
         return m->type;
     }
@@ -3,12 +3,24 @@
 #include <libs/common/types.h>
 
 error_t ipc_send(task_t dst, struct message *m);
+error_t ipc_sendv(task_t dst, const struct ipc_iovec *iovs, int num_iovs);
+error_t ipc_send_port(task_t dst, unsigned port, struct message *m);
+error_t ipc_sendv_port(task_t dst, unsigned port, const struct ipc_iovec *iovs,
+                       int num_iovs);
 error_t ipc_send_noblock(task_t dst, struct message *m);
 error_t ipc_send_async(task_t dst, struct message *m);
 void ipc_reply(task_t dst, struct message *m);
 void ipc_reply_err(task_t dst, error_t error);
 error_t ipc_recv(task_t src, struct message *m);
+error_t ipc_recv_ool(task_t src, struct message *m, void *ool_window);
+error_t ipc_recv_ports(unsigned ports, struct message *m);
+error_t ipc_recv_timeout(task_t src, struct message *m, unsigned timeout);
+error_t ipc_reply_recv(task_t dst, struct message *m);
+error_t ipc_reply_recv_ool(task_t dst, struct message *m, void *ool_window);
 error_t ipc_call(task_t dst, struct message *m);
+error_t ipc_call_ool(task_t dst, struct message *m, void *ool_window);
+error_t ipc_call_timeout(task_t dst, struct message *m, unsigned timeout);
+error_t ipc_callv(task_t dst, const struct ipc_iovec *iovs, int num_iovs);
 error_t ipc_notify(task_t dst, notifications_t notifications);
 error_t ipc_register(const char *name);
 task_t ipc_lookup(const char *name);
@@ -2,12 +2,15 @@
 #include <libs/common/print.h>
 #include <libs/common/string.h>
 #include <libs/user/malloc.h>
+#include <libs/user/thread.h>
 
 extern char __heap[];      // ヒープ領域の先頭アドレス
 extern char __heap_end[];  // ヒープ領域の終端アドレス
 
 // 未使用チャンクリスト
 static list_t free_chunks = LIST_INIT(free_chunks);
+// free_chunksを保護するロック (複数のスレッドから同時に呼ばれる場合のため)
+static struct spinlock malloc_lock = SPINLOCK_INIT;
 
 // ptrからlenバイトのメモリ領域を新しいチャンクとして登録する。
 static void insert(void *ptr, size_t len) {
@@ -47,6 +50,7 @@ void *malloc(size_t size) {
     // つまり、8、16、24、32、...という単位で割り当てる。
     size = ALIGN_UP((size == 0) ? 1 : size, 8);
 
+    spin_lock(&malloc_lock);
     LIST_FOR_EACH (chunk, &free_chunks, struct malloc_chunk, next) {
         ASSERT(chunk->magic == MALLOC_FREE);
 
@@ -65,6 +69,7 @@ void *malloc(size_t size) {
             chunk->magic = MALLOC_IN_USE;
             chunk->size = size;
             list_remove(&chunk->next);
+            spin_unlock(&malloc_lock);
 
             // 割り当てられたメモリ領域をゼロクリアする。本来は呼び出し元が
             // きちんと初期化すべきだが、初期化し忘れバグのデバッグは大変なので
@@ -95,8 +100,10 @@ void free(void *ptr) {
     }
 
     // チャンクをフリーリストに戻す
+    spin_lock(&malloc_lock);
     chunk->magic = MALLOC_FREE;
     list_push_back(&free_chunks, &chunk->next);
+    spin_unlock(&malloc_lock);
 }
 
 // メモリ再割り当て。malloc関数で割り当てたメモリ領域をsizeバイトに拡張した
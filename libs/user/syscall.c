@@ -4,8 +4,10 @@
 #include <libs/user/syscall.h>
 
 // ipcシステムコール: メッセージの送受信
-error_t sys_ipc(task_t dst, task_t src, struct message *m, unsigned flags) {
-    return arch_syscall(dst, src, (uintptr_t) m, flags, 0, SYS_IPC);
+error_t sys_ipc(task_t dst, task_t src, struct message *m, unsigned flags,
+                void *ool_window) {
+    return arch_syscall(dst, src, (uintptr_t) m, flags, (uintptr_t) ool_window,
+                        SYS_IPC);
 }
 
 // notifyシステムコール: 通知の送信
@@ -30,6 +32,26 @@ error_t sys_task_destroy(task_t task) {
     return arch_syscall(task, 0, 0, 0, 0, SYS_TASK_DESTROY);
 }
 
+// task_priorityシステムコール: タスクの優先度の変更
+error_t sys_task_priority(task_t task, int priority) {
+    return arch_syscall(task, priority, 0, 0, 0, SYS_TASK_PRIORITY);
+}
+
+// task_affinityシステムコール: タスクのCPUアフィニティ (実行してよいCPU) の変更
+error_t sys_task_affinity(task_t task, uint32_t affinity) {
+    return arch_syscall(task, affinity, 0, 0, 0, SYS_TASK_AFFINITY);
+}
+
+// thread_createシステムコール: 実行中タスクと同じアドレス空間で動くスレッドの作成
+task_t sys_thread_create(uaddr_t ip, uaddr_t sp, uaddr_t arg) {
+    return arch_syscall(ip, sp, arg, 0, 0, SYS_THREAD_CREATE);
+}
+
+// thread_joinシステムコール: スレッドの終了待ちと削除
+error_t sys_thread_join(task_t thread) {
+    return arch_syscall(thread, 0, 0, 0, 0, SYS_THREAD_JOIN);
+}
+
 // task_exitシステムコール: 実行中タスクの終了
 __noreturn void sys_task_exit(void) {
     arch_syscall(0, 0, 0, 0, 0, SYS_TASK_EXIT);
@@ -76,9 +98,19 @@ int sys_serial_read(const char *buf, int max_len) {
     return arch_syscall((uintptr_t) buf, max_len, 0, 0, 0, SYS_SERIAL_READ);
 }
 
-// timeシステムコール: タイムアウトの設定
+// timeシステムコール: タイムアウトの設定 (0番目のタイマー)
 error_t sys_time(int milliseconds) {
-    return arch_syscall(milliseconds, 0, 0, 0, 0, SYS_TIME);
+    return sys_timer(0, milliseconds);
+}
+
+// timeシステムコール: 指定した番号のタイマーのタイムアウトの設定
+error_t sys_timer(unsigned id, int milliseconds) {
+    return arch_syscall(milliseconds, id, 0, 0, 0, SYS_TIME);
+}
+
+// lock_statsシステムコール: カーネル内のロックの統計情報の表示
+error_t sys_lock_stats(unsigned flags) {
+    return arch_syscall(flags, 0, 0, 0, 0, SYS_LOCK_STATS);
 }
 
 // uptimeシステムコール: システムの起動時間の取得 (ミリ秒)
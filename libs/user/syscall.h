@@ -5,12 +5,17 @@
 
 struct message;
 
-error_t sys_ipc(task_t dst, task_t src, struct message *m, unsigned flags);
+error_t sys_ipc(task_t dst, task_t src, struct message *m, unsigned flags,
+                void *ool_window);
 error_t sys_notify(task_t dst, notifications_t notifications);
 task_t sys_task_create(const char *name, vaddr_t ip, task_t pager);
 task_t sys_hinavm(const char *name, hinavm_inst_t *insts, size_t num_insts,
                   task_t pager);
 error_t sys_task_destroy(task_t task);
+error_t sys_task_priority(task_t task, int priority);
+error_t sys_task_affinity(task_t task, uint32_t affinity);
+task_t sys_thread_create(uaddr_t ip, uaddr_t sp, uaddr_t arg);
+error_t sys_thread_join(task_t thread);
 __noreturn void sys_task_exit(void);
 task_t sys_task_self(void);
 pfn_t sys_pm_alloc(task_t tid, size_t size, unsigned flags);
@@ -21,5 +26,7 @@ error_t sys_irq_unlisten(unsigned irq);
 int sys_serial_write(const char *buf, size_t len);
 int sys_serial_read(const char *buf, int max_len);
 error_t sys_time(int milliseconds);
+error_t sys_timer(unsigned id, int milliseconds);
 int sys_uptime(void);
+error_t sys_lock_stats(unsigned flags);
 __noreturn void sys_shutdown(void);
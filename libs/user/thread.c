@@ -0,0 +1,94 @@
+#include <libs/common/list.h>
+#include <libs/common/print.h>
+#include <libs/user/malloc.h>
+#include <libs/user/syscall.h>
+#include <libs/user/thread.h>
+
+// スレッドの管理構造体
+struct thread {
+    list_elem_t next;      // スレッドのリストの要素
+    task_t tid;            // スレッドのタスクID
+    void (*func)(void *);  // スレッドで実行する関数
+    void *arg;             // funcに渡す引数
+    uint8_t *stack;        // スタック領域 (THREAD_STACK_SIZEバイト)
+};
+
+// 作成済みのスレッドのリスト
+static list_t threads = LIST_INIT(threads);
+// threadsを保護するロック
+static struct spinlock threads_lock = SPINLOCK_INIT;
+
+// スピンロックを取得する。
+void spin_lock(struct spinlock *lock) {
+    while (!compare_and_swap(&lock->locked, 0, 1)) {
+        ;
+    }
+}
+
+// スピンロックを解放する。
+void spin_unlock(struct spinlock *lock) {
+    full_memory_barrier();
+    lock->locked = 0;
+}
+
+// スレッドのエントリーポイント。カーネルから直接呼び出される。
+__noreturn static void thread_entry(struct thread *thread) {
+    thread->func(thread->arg);
+    sys_task_exit();
+}
+
+// スレッドを作成し、func(arg)を実行させる。スレッドはfuncから戻ると終了する。終了した
+// スレッドはthread_join関数で削除する必要がある。
+task_t thread_create(void (*func)(void *arg), void *arg) {
+    struct thread *thread = malloc(sizeof(*thread));
+    thread->tid = 0;
+    thread->func = func;
+    thread->arg = arg;
+    thread->stack = malloc(THREAD_STACK_SIZE);
+
+    spin_lock(&threads_lock);
+    list_push_back(&threads, &thread->next);
+    spin_unlock(&threads_lock);
+
+    // スタックは上位アドレスから下位アドレスへ伸びる
+    uaddr_t sp = ALIGN_DOWN((uaddr_t) &thread->stack[THREAD_STACK_SIZE], 16);
+    task_t tid_or_err = sys_thread_create((uaddr_t) thread_entry, sp,
+                                          (uaddr_t) thread);
+    if (IS_ERROR(tid_or_err)) {
+        spin_lock(&threads_lock);
+        list_remove(&thread->next);
+        spin_unlock(&threads_lock);
+        free(thread->stack);
+        free(thread);
+        return tid_or_err;
+    }
+
+    spin_lock(&threads_lock);
+    thread->tid = tid_or_err;
+    spin_unlock(&threads_lock);
+    return tid_or_err;
+}
+
+// スレッドの終了を待ち、スレッドを削除する。
+error_t thread_join(task_t tid) {
+    error_t err = sys_thread_join(tid);
+    if (err != OK) {
+        return err;
+    }
+
+    // スレッドのスタック領域を解放する
+    spin_lock(&threads_lock);
+    LIST_FOR_EACH (thread, &threads, struct thread, next) {
+        if (thread->tid == tid) {
+            list_remove(&thread->next);
+            spin_unlock(&threads_lock);
+            free(thread->stack);
+            free(thread);
+            return OK;
+        }
+    }
+
+    spin_unlock(&threads_lock);
+    WARN("thread #%d is not created by thread_create", tid);
+    return OK;
+}
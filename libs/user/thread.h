@@ -0,0 +1,17 @@
+#pragma once
+#include <libs/common/types.h>
+
+#define THREAD_STACK_SIZE (16 * 1024)  // スレッドのスタックサイズ
+
+// スレッド間の排他制御に使うスピンロック
+struct spinlock {
+    uint32_t locked;  // ロックが取得されているかどうか
+};
+
+#define SPINLOCK_INIT                                                          \
+    { .locked = 0 }
+
+task_t thread_create(void (*func)(void *arg), void *arg);
+error_t thread_join(task_t thread);
+void spin_lock(struct spinlock *lock);
+void spin_unlock(struct spinlock *lock);
@@ -1,7 +1,6 @@
 #include "block.h"
 #include "fs.h"
 #include <libs/common/print.h>
-#include <libs/common/string.h>
 #include <libs/user/ipc.h>
 #include <libs/user/malloc.h>
 #include <servers/virtio_blk/virtio_blk.h>  // SECTOR_SIZE
@@ -12,6 +11,15 @@ static task_t blk_server;
 static list_t cached_blocks = LIST_INIT(cached_blocks);
 // 変更済みブロックのリスト。ディスクに書き戻す必要がある。
 static list_t dirty_blocks = LIST_INIT(dirty_blocks);
+// ブロックの内容を置く領域。読み込み時にはデバイスドライバサーバから受け取ったページが
+// 空いている要素にそのままマップされ、書き込み時にはそのページをデバイスドライバサーバへ
+// 移動し、返信で返してもらう。使われていない要素にはページがマップされない。
+static __aligned(PAGE_SIZE) uint8_t
+    block_pages[NUM_CACHED_BLOCKS_MAX][BLOCK_SIZE];
+// block_pagesのうち、使用済みの要素の数。
+static unsigned num_block_pages = 0;
+
+STATIC_ASSERT(BLOCK_SIZE == PAGE_SIZE, "block size must be equal to page size");
 
 // ブロック番号をセクタ番号に変換する。
 static uint64_t block_to_sector(block_t index) {
@@ -23,21 +31,53 @@ static bool block_is_dirty(struct block *block) {
     return list_is_linked(&block->dirty_next);
 }
 
+// デバイスからブロックを読み込み、そのページをdataにマップする。
+static error_t read_from_disk(block_t index, uint8_t *data) {
+    struct message m;
+    m.type = BLK_READ_MSG;
+    m.blk_read.sector = block_to_sector(index);
+    m.blk_read.len = BLOCK_SIZE;
+    error_t err = ipc_call_ool(blk_server, &m, data);
+
+    if (err != OK) {
+        OOPS("failed to read block %d: %s", index, err2str(err));
+        return err;
+    }
+
+    if (m.type != BLK_READ_REPLY_MSG) {
+        OOPS("unexpected reply message type \"%s\" (expected=%s)",
+             msgtype2str(m.type), msgtype2str(BLK_READ_REPLY_MSG));
+        return ERR_UNEXPECTED;
+    }
+
+    if (m.blk_read_reply.data_len != BLOCK_SIZE) {
+        OOPS("invalid data length from the device: %d",
+             m.blk_read_reply.data_len);
+        return ERR_UNEXPECTED;
+    }
+
+    return OK;
+}
+
 // ブロックをディスクに書き込む。
 static void block_write(struct block *block) {
-    unsigned sector_base = block_to_sector(block->index);
-    // 各セクタごとに書き込む
-    for (int offset = 0; offset < BLOCK_SIZE; offset += SECTOR_SIZE) {
-        struct message m;
-        m.type = BLK_WRITE_MSG;
-        m.blk_write.sector = sector_base + (offset / SECTOR_SIZE);
-        m.blk_write.data_len = SECTOR_SIZE;
-        memcpy(m.blk_write.data, block->data + offset, SECTOR_SIZE);
-        error_t err = ipc_call(blk_server, &m);
-        if (err != OK) {
-            OOPS("failed to write block %d: %s", block->index, err2str(err));
-        }
+    // ブロックの内容をページごとデバイスドライバサーバへ移動して書き込み、返信で同じページを
+    // block->dataに返してもらう。
+    struct message m;
+    m.type = BLK_WRITE_MSG;
+    m.blk_write.sector = block_to_sector(block->index);
+    m.blk_write.data = (uaddr_t) block->data;
+    m.blk_write.data_len = BLOCK_SIZE;
+    error_t err = ipc_call_ool(blk_server, &m, block->data);
+    if (err == OK && m.type == BLK_WRITE_REPLY_MSG
+        && m.blk_write_reply.data_len == BLOCK_SIZE) {
+        return;
     }
+
+    // ページが返ってこなかった場合は、ディスクから読み直してブロックの内容を復元する
+    OOPS("failed to write block %d: %s", block->index,
+         err2str(err != OK ? err : ERR_UNEXPECTED));
+    read_from_disk(block->index, block->data);
 }
 
 // ブロックをブロックキャッシュに読み込む。
@@ -55,43 +95,26 @@ error_t block_read(block_t index, struct block **block) {
         }
     }
 
-    // ブロックキャッシュのメモリ領域を確保して、各セクタを読み込む。
-    TRACE("block %d is not in cache, reading from disk", index);
-    struct block *new_block = malloc(sizeof(struct block));
-    for (int offset = 0; offset < BLOCK_SIZE; offset += SECTOR_SIZE) {
-        // デバイスドライバサーバに対して、セクタ読み込み要求を送る。
-        struct message m;
-        m.type = BLK_READ_MSG;
-        m.blk_read.sector = block_to_sector(index) + (offset / SECTOR_SIZE);
-        m.blk_read.len = SECTOR_SIZE;
-        error_t err = ipc_call(blk_server, &m);
-
-        if (err != OK) {
-            OOPS("failed to read block %d: %s", index, err2str(err));
-            free(new_block);
-            return err;
-        }
-
-        if (m.type != BLK_READ_REPLY_MSG) {
-            OOPS("unexpected reply message type \"%s\" (expected=%s)",
-                 msgtype2str(m.type), msgtype2str(BLK_READ_REPLY_MSG));
-            free(new_block);
-            return ERR_UNEXPECTED;
-        }
-
-        if (m.blk_read_reply.data_len != SECTOR_SIZE) {
-            OOPS("invalid data length from the device: %d",
-                 m.blk_read_reply.data_len);
-            free(new_block);
-            return ERR_UNEXPECTED;
-        }
+    if (num_block_pages == NUM_CACHED_BLOCKS_MAX) {
+        OOPS("too many cached blocks");
+        return ERR_NO_MEMORY;
+    }
 
-        // ブロックキャッシュに読み込んだディスクデータをコピーする。
-        memcpy(&new_block->data[offset], m.blk_read_reply.data, SECTOR_SIZE);
+    // デバイスドライバサーバに対して、ブロック読み込み要求を送る。読み込んだデータは
+    // ページごとblock_pagesの空いている要素にマップされるので、コピーは不要。
+    TRACE("block %d is not in cache, reading from disk", index);
+    uint8_t *data = block_pages[num_block_pages];
+    error_t err = read_from_disk(index, data);
+    if (err != OK) {
+        return err;
     }
 
+    num_block_pages++;
+
     // ブロックキャッシュをリストに追加し、そのポインタを返す。
+    struct block *new_block = malloc(sizeof(struct block));
     new_block->index = index;
+    new_block->data = data;
     list_elem_init(&new_block->cache_next);
     list_elem_init(&new_block->dirty_next);
     list_push_back(&cached_blocks, &new_block->cache_next);
@@ -106,6 +129,11 @@ void block_mark_as_dirty(struct block *block) {
     }
 }
 
+// 変更済みブロックがあるかを返す。
+bool block_has_dirty(void) {
+    return !list_is_empty(&dirty_blocks);
+}
+
 // 変更済みブロックをすべてディスクに書き込む。
 void block_flush_all(void) {
     LIST_FOR_EACH (b, &dirty_blocks, struct block, dirty_next) {
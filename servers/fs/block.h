@@ -5,6 +5,8 @@
 
 // ブロックのサイズ (バイト)
 #define BLOCK_SIZE 4096
+// キャッシュできるブロックの最大数
+#define NUM_CACHED_BLOCKS_MAX 1024
 
 // ブロック番号
 typedef uint16_t block_t;
@@ -14,14 +16,18 @@ typedef uint16_t block_t;
 // ストレージデバイスの内容を読み書きする際には、まずデバイスからBLOCK_SIZE分のデータを一気に
 // 読み出してブロックキャッシュとして追加し、ファイルシステム実装はメモリ上にあるキャッシュデータ
 // を読み書きする。
+//
+// ブロックの内容はページ境界にアラインされた領域に置かれ、デバイスドライバサーバとはページごと
+// 移動してやり取りする。
 struct block {
-    block_t index;             // ディスク上のブロック番号
-    list_elem_t cache_next;    // ブロックキャッシュのリストの要素
-    list_elem_t dirty_next;    // 変更済みブロックキャッシュのリストの要素
-    uint8_t data[BLOCK_SIZE];  // ブロックの内容
+    block_t index;           // ディスク上のブロック番号
+    list_elem_t cache_next;  // ブロックキャッシュのリストの要素
+    list_elem_t dirty_next;  // 変更済みブロックキャッシュのリストの要素
+    uint8_t *data;           // ブロックの内容 (BLOCK_SIZEバイト)
 };
 
 error_t block_read(block_t index, struct block **block);
 void block_mark_as_dirty(struct block *block);
+bool block_has_dirty(void);
 void block_flush_all(void);
 void block_init(void);
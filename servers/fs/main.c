@@ -8,6 +8,9 @@
 // 開いているファイルの一覧。インデックスがファイルディスクリプタとして使われる。
 // 全タスクで共有される。
 static struct open_file open_files[OPEN_FILES_MAX];
+// ファイルから読み込んだデータを入れるバッファ。読み込み要求でクライアントが貸し出した
+// ページがここにマップされ、データを書き込んだ上で返信時にクライアントへ返す。
+static __aligned(PAGE_SIZE) uint8_t read_buf[PAGE_SIZE];
 
 // ファイルディスクリプタを割り当てる。
 static int alloc_fd(void) {
@@ -120,13 +123,23 @@ void main(void) {
     ASSERT_OK(ipc_register("fs"));
     TRACE("ready");
 
+    task_t reply_to = 0;  // 返信先のタスク (0の場合は返信しない)
     while (true) {
-        // 変更済みブロックをディスクに書き戻す
-        block_flush_all();
+        // 変更済みブロックをディスクに書き戻す。クライアントを書き込みの完了まで待たせない
+        // ように、返信を先に済ませておく。
+        if (block_has_dirty()) {
+            if (reply_to) {
+                ipc_reply(reply_to, &m);
+                reply_to = 0;
+            }
+
+            block_flush_all();
+        }
 
-        struct message m;
-        error_t err = ipc_recv(IPC_ANY, &m);
+        // 前回のメッセージへの返信と、次のメッセージの受信を1回のシステムコールで行う
+        error_t err = ipc_reply_recv_ool(reply_to, &m, read_buf);
         ASSERT_OK(err);
+        reply_to = 0;
 
         switch (m.type) {
             case TASK_DESTROYED_MSG: {
@@ -143,35 +156,37 @@ void main(void) {
 
                 int fd_or_err = do_open(m.src, path);
                 if (IS_ERROR(fd_or_err)) {
-                    ipc_reply_err(m.src, fd_or_err);
+                    m.type = fd_or_err;
+                    reply_to = m.src;
                     break;
                 }
 
                 m.type = FS_OPEN_REPLY_MSG;
                 m.fs_open_reply.fd = fd_or_err;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case FS_CLOSE_MSG: {
                 free_fd(m.src, m.fs_close.fd);
                 m.type = FS_CLOSE_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case FS_READ_MSG: {
-                uint8_t buf[512];
-                size_t len = MIN(m.fs_read.len, sizeof(buf));
+                size_t len = MIN(m.fs_read.len, sizeof(read_buf));
                 int read_len =
-                    do_readwrite(m.src, m.fs_read.fd, buf, len, false);
+                    do_readwrite(m.src, m.fs_read.fd, read_buf, len, false);
                 if (IS_ERROR(read_len)) {
-                    ipc_reply_err(m.src, read_len);
+                    m.type = read_len;
+                    reply_to = m.src;
                     break;
                 }
 
+                // 借りたページをクライアントへ返す
                 m.type = FS_READ_REPLY_MSG;
-                memcpy(m.fs_read_reply.data, buf, read_len);
+                m.fs_read_reply.data = (uaddr_t) read_buf;
                 m.fs_read_reply.data_len = read_len;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case FS_WRITE_MSG: {
@@ -180,13 +195,14 @@ void main(void) {
                                                   m.fs_write.data, len, true);
                 if (IS_ERROR(written_len)) {
                     WARN("failed to write a file (%s)", err2str(written_len));
-                    ipc_reply_err(m.src, written_len);
+                    m.type = written_len;
+                    reply_to = m.src;
                     break;
                 }
 
                 m.type = FS_WRITE_REPLY_MSG;
                 m.fs_write_reply.written_len = written_len;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case FS_READDIR_MSG: {
@@ -196,7 +212,8 @@ void main(void) {
                 struct hinafs_entry *entry;
                 error_t err = fs_readdir(path, m.fs_readdir.index, &entry);
                 if (IS_ERROR(err)) {
-                    ipc_reply_err(m.src, err);
+                    m.type = err;
+                    reply_to = m.src;
                     break;
                 }
 
@@ -206,7 +223,7 @@ void main(void) {
                 m.fs_readdir_reply.type = entry->type;
                 m.fs_readdir_reply.filesize =
                     (entry->type == FS_TYPE_FILE) ? entry->size : 0;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case FS_MKFILE_MSG: {
@@ -215,12 +232,13 @@ void main(void) {
 
                 error_t err = fs_create(path, FS_TYPE_FILE);
                 if (err != OK) {
-                    ipc_reply_err(m.src, err);
+                    m.type = err;
+                    reply_to = m.src;
                     break;
                 }
 
                 m.type = FS_MKFILE_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case FS_MKDIR_MSG: {
@@ -229,12 +247,13 @@ void main(void) {
 
                 error_t err = fs_create(path, FS_TYPE_DIR);
                 if (IS_ERROR(err)) {
-                    ipc_reply_err(m.src, err);
+                    m.type = err;
+                    reply_to = m.src;
                     break;
                 }
 
                 m.type = FS_MKDIR_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case FS_DELETE_MSG: {
@@ -243,12 +262,13 @@ void main(void) {
 
                 error_t err = fs_delete(path);
                 if (IS_ERROR(err)) {
-                    ipc_reply_err(m.src, err);
+                    m.type = err;
+                    reply_to = m.src;
                     break;
                 }
 
                 m.type = FS_DELETE_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             default:
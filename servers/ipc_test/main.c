@@ -0,0 +1,160 @@
+#include <libs/common/print.h>
+#include <libs/common/string.h>
+#include <libs/user/ipc.h>
+#include <libs/user/syscall.h>
+#include <libs/user/thread.h>
+
+// ポートへの送信を行うスレッドの数
+#define NUM_PORT_SENDERS 3
+// 他のCPUで動くスレッドへのipc_callの回数
+#define NUM_SPIN_CALLS 256
+
+// ポートへの送信を行うスレッドの引数
+struct port_sender {
+    unsigned port;  // 送信先のポート
+    int value;      // 送信する値
+};
+
+static task_t self;
+
+// msミリ秒待つ。VMサーバからは何も送られてこないので、必ずタイムアウトする。
+static void sleep_ms(unsigned ms) {
+    struct message m;
+    error_t err = ipc_recv_timeout(VM_SERVER, &m, ms);
+    ASSERT(err == ERR_TIMEOUT);
+}
+
+// 受信のタイムアウトを確認する。
+static void test_timeout(void) {
+    struct message m;
+    ASSERT(ipc_recv_timeout(IPC_ANY, &m, 50) == ERR_TIMEOUT);
+    sleep_ms(50);
+    INFO("timeout: OK");
+}
+
+// 指定されたポートへPINGメッセージを送信するスレッド
+static void send_to_port(void *arg) {
+    struct port_sender *sender = arg;
+    struct message m;
+    m.type = PING_MSG;
+    m.ping.value = sender->value;
+    ASSERT_OK(ipc_send_port(self, sender->port, &m));
+}
+
+// PINGメッセージを受信し、値を返す。
+static int recv_ping(unsigned ports) {
+    struct message m;
+    ASSERT_OK(ports ? ipc_recv_ports(ports, &m) : ipc_recv(IPC_ANY, &m));
+    ASSERT(m.type == PING_MSG);
+    return m.ping.value;
+}
+
+// ポートの優先度と選択的受信を確認する。
+static void test_ports(void) {
+    static struct port_sender senders[NUM_PORT_SENDERS] = {
+        {.port = 0, .value = 0},
+        {.port = 3, .value = 3},
+        {.port = 1, .value = 1},
+    };
+
+    task_t threads[NUM_PORT_SENDERS];
+    for (int i = 0; i < NUM_PORT_SENDERS; i++) {
+        threads[i] = thread_create(send_to_port, &senders[i]);
+        ASSERT_OK(threads[i]);
+    }
+
+    // 全スレッドが送信待ちになるまで待つ
+    sleep_ms(100);
+
+    // ポート1のみを受信し、残りは番号が大きいポートから受信する
+    ASSERT(recv_ping(1 << 1) == 1);
+    ASSERT(recv_ping(0) == 3);
+    ASSERT(recv_ping(0) == 0);
+
+    for (int i = 0; i < NUM_PORT_SENDERS; i++) {
+        ASSERT_OK(thread_join(threads[i]));
+    }
+
+    INFO("ports: OK");
+}
+
+// 非同期メッセージが送信順に届くことを確認する。ipc_test_peerはカーネルの非同期メッセージ
+// キューが一杯になる (ERR_TRY_AGAIN) まで送信し、最後に送信できた数を負の値で送ってくる。
+static void test_async(void) {
+    struct message m;
+    m.type = SPAWN_TASK_MSG;
+    strcpy_safe(m.spawn_task.name, sizeof(m.spawn_task.name), "ipc_test_peer");
+    ASSERT_OK(ipc_call(VM_SERVER, &m));
+    task_t peer = m.spawn_task_reply.task;
+
+    // 受信せずに待ち、ipc_test_peerにキューを一杯にさせる
+    sleep_ms(500);
+
+    int i = 0;
+    int value;
+    while ((value = recv_ping(0)) >= 0) {
+        ASSERT(value == i);
+        i++;
+    }
+
+    ASSERT(value == -i);
+
+    // ipc_test_peerを終了させる
+    m.type = PING_MSG;
+    m.ping.value = -1;
+    ASSERT_OK(ipc_send(peer, &m));
+    INFO("async: OK");
+}
+
+// 受信したPINGメッセージの値に1を足して返信するスレッド。値が負であれば終了する。
+static void ping_server(void *arg) {
+    while (true) {
+        struct message m;
+        ASSERT_OK(ipc_recv(IPC_ANY, &m));
+        ASSERT(m.type == PING_MSG);
+        if (m.ping.value < 0) {
+            return;
+        }
+
+        m.type = PING_REPLY_MSG;
+        m.ping_reply.value = m.ping.value + 1;
+        ipc_reply(m.src, &m);
+    }
+}
+
+// 他のCPUでしか実行できないスレッドを呼び出す。直接切り替えられないので、カーネルは
+// 返信をスピンして待つ。スピンの成功回数はlockstatシステムコールで表示する (CPUが1つの
+// 場合は同じCPUで実行される)。
+static void test_spin(void) {
+    task_t server = thread_create(ping_server, NULL);
+    ASSERT_OK(server);
+    ASSERT_OK(sys_task_affinity(server, 1 << 1));
+    ASSERT_OK(sys_task_affinity(self, 1 << 0));
+
+    struct message m;
+    for (int i = 0; i < NUM_SPIN_CALLS; i++) {
+        m.type = PING_MSG;
+        m.ping.value = i;
+        ASSERT_OK(ipc_call(server, &m));
+        ASSERT(m.type == PING_REPLY_MSG && m.ping_reply.value == i + 1);
+    }
+
+    m.type = PING_MSG;
+    m.ping.value = -1;
+    ASSERT_OK(ipc_send(server, &m));
+    ASSERT_OK(thread_join(server));
+
+    ASSERT_OK(sys_lock_stats(0));
+    INFO("spin: OK");
+}
+
+void main(void) {
+    self = sys_task_self();
+    ASSERT_OK(ipc_register("ipc_test"));
+
+    test_timeout();
+    test_ports();
+    test_async();
+    // 自身のアフィニティを変更するので最後に行う
+    test_spin();
+}
@@ -0,0 +1,34 @@
+#include <libs/common/print.h>
+#include <libs/user/ipc.h>
+
+// ipc_testの非同期メッセージのテストで、送信側として使われるプログラム。ipc_testの
+// 非同期メッセージキューが一杯になるまで送信し、送信できた数を通常の送信で伝える。
+void main(void) {
+    task_t ipc_test = ipc_lookup("ipc_test");
+    struct message m;
+    int sent = 0;
+    while (true) {
+        m.type = PING_MSG;
+        m.ping.value = sent;
+        error_t err = ipc_send_async(ipc_test, &m);
+        if (err == ERR_TRY_AGAIN) {
+            break;
+        }
+
+        ASSERT_OK(err);
+        sent++;
+    }
+
+    ASSERT(sent > 0);
+    m.type = PING_MSG;
+    m.ping.value = -sent;
+    ASSERT_OK(ipc_send(ipc_test, &m));
+
+    // ipc_testから終了の合図が来るまで待つ
+    while (true) {
+        ASSERT_OK(ipc_recv(IPC_ANY, &m));
+        if (m.type == PING_MSG && m.src == ipc_test) {
+            break;
+        }
+    }
+}
@@ -142,6 +142,19 @@ static void do_uptime(struct args *args) {
     printf("%d seconds\n", sys_uptime());
 }
 
+static void do_lockstat(struct args *args) {
+    unsigned flags = 0;
+    if (args->argc == 2 && !strcmp(args->argv[1], "reset")) {
+        flags |= LOCK_STATS_RESET;
+    } else if (args->argc != 1) {
+        WARN("Usage: lockstat [reset]");
+        return;
+    }
+
+    // 統計情報はカーネルがシリアルポートに出力する
+    ASSERT_OK(sys_lock_stats(flags));
+}
+
 __noreturn static void do_shutdown(struct args *args) {
     INFO("shutting down...");
     sys_shutdown();
@@ -161,6 +174,7 @@ static struct command commands[] = {
     {.name = "sleep", .run = do_sleep, .help = "Pause for a while"},
     {.name = "ping", .run = do_ping, .help = "Send a ping to pong server"},
     {.name = "uptime", .run = do_uptime, .help = "Show seconds since boot"},
+    {.name = "lockstat", .run = do_lockstat, .help = "Show kernel lock stats"},
     {.name = "shutdown", .run = do_shutdown, .help = "Shut down the system"},
     {.name = NULL},
 };
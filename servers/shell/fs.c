@@ -20,11 +20,20 @@ void fs_read(const char *path) {
     ASSERT(m.type == FS_OPEN_REPLY_MSG);
     int fd = m.fs_open_reply.fd;
 
+    // ファイルの内容を受け取るバッファ。このページをfsサーバに貸し出し、データを書き込んだ
+    // 上で返してもらう。
+    static __aligned(PAGE_SIZE) char buf[PAGE_SIZE];
     while (true) {
+        // 貸し出すページがマップされているように、先に書き込んでおく。エラーの返信では
+        // ページは返ってこないので、毎回行う。
+        buf[0] = '\0';
+
         m.type = FS_READ_MSG;
         m.fs_read.fd = fd;
-        m.fs_read.len = PAGE_SIZE;
-        error_t err = err = ipc_call(fs_server, &m);
+        m.fs_read.len = sizeof(buf) - 1;  // ヌル終端文字の分を残しておく
+        m.fs_read.buf = (uaddr_t) buf;
+        m.fs_read.buf_len = sizeof(buf);
+        error_t err = ipc_call_ool(fs_server, &m, buf);
         if (err == ERR_EOF) {
             break;
         }
@@ -35,10 +44,9 @@ void fs_read(const char *path) {
         }
 
         ASSERT(m.type == FS_READ_REPLY_MSG);
-        unsigned end =
-            MIN(sizeof(m.fs_read_reply.data) - 1, m.fs_read_reply.data_len);
-        m.fs_read_reply.data[end] = '\0';
-        DBG("%s", m.fs_read_reply.data);
+        unsigned end = MIN(sizeof(buf) - 1, m.fs_read_reply.data_len);
+        buf[end] = '\0';
+        DBG("%s", buf);
     }
 }
 
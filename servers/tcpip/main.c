@@ -8,7 +8,6 @@
 #include <libs/common/print.h>
 #include <libs/common/string.h>
 #include <libs/user/ipc.h>
-#include <libs/user/malloc.h>
 #include <libs/user/syscall.h>
 
 // ネットワークデバイスドライバサーバ
@@ -69,13 +68,12 @@ void callback_ethernet_transmit(mbuf_t pkt) {
         return;
     }
 
-    uint8_t *payload = malloc(len);
-    mbuf_read(&pkt, payload, len);
-    mbuf_delete(pkt);
-
+    // パケットをメッセージに直接読み込む
     m.type = NET_SEND_MSG;
     m.net_send.payload_len = len;
-    memcpy(m.net_send.payload, payload, len);
+    mbuf_read(&pkt, m.net_send.payload, len);
+    mbuf_delete(pkt);
+
     error_t err = ipc_send_async(net_device, &m);
     if (err != OK) {
         WARN("failed to send packet to driver: %s", err2str(err));
@@ -95,7 +93,7 @@ void callback_tcp_data(struct tcp_pcb *pcb) {
     struct message m;
     m.type = TCPIP_DATA_MSG;
     m.tcpip_data.sock = sock->fd;
-    ipc_send_async(sock->task, &m);
+    OOPS_OK(ipc_send_async(sock->task, &m));
 }
 
 // TCPコネクションが閉じられたとき (パッシブクローズ) に呼ばれる。
@@ -105,7 +103,7 @@ void callback_tcp_fin(struct tcp_pcb *pcb) {
     struct message m;
     m.type = TCPIP_CLOSED_MSG;
     m.tcpip_closed.sock = sock->fd;
-    ipc_send_async(sock->task, &m);
+    OOPS_OK(ipc_send_async(sock->task, &m));
 }
 
 // TCPコネクションがリセットされたときに呼ばれる。
@@ -115,7 +113,7 @@ void callback_tcp_rst(struct tcp_pcb *pcb) {
     struct message m;
     m.type = TCPIP_CLOSED_MSG;
     m.tcpip_closed.sock = sock->fd;
-    ipc_send_async(sock->task, &m);
+    OOPS_OK(ipc_send_async(sock->task, &m));
 }
 
 // DNSサーバから応答が届いたときに呼ばれる。
@@ -177,13 +175,22 @@ void main(void) {
     ASSERT_OK(ipc_register("tcpip"));
 
     TRACE("ready");
+    task_t reply_to = 0;  // 返信先のタスク (0の場合は返信しない)
     while (true) {
-        // TCPの送信処理を行う。
-        tcp_flush();
+        // TCPの送信処理を行う。クライアントを待たせないように、返信を先に済ませておく。
+        if (tcp_needs_flush()) {
+            if (reply_to) {
+                ipc_reply(reply_to, &m);
+                reply_to = 0;
+            }
 
-        struct message m;
-        error_t err = ipc_recv(IPC_ANY, &m);
+            tcp_flush();
+        }
+
+        // 前回のメッセージへの返信と、次のメッセージの受信を1回のシステムコールで行う
+        error_t err = ipc_reply_recv(reply_to, &m);
         ASSERT_OK(err);
+        reply_to = 0;
 
         switch (m.type) {
             case NOTIFY_TIMER_MSG: {
@@ -222,7 +229,8 @@ void main(void) {
                                           m.tcpip_connect.dst_port);
                 if (err != OK) {
                     sock->used = false;
-                    ipc_reply_err(m.src, err);
+                    m.type = err;
+                    reply_to = m.src;
                     break;
                 }
 
@@ -237,7 +245,8 @@ void main(void) {
             case TCPIP_WRITE_MSG: {
                 struct socket *sock = lookup_socket(m.src, m.tcpip_write.sock);
                 if (!sock) {
-                    ipc_reply_err(m.src, ERR_INVALID_ARG);
+                    m.type = ERR_INVALID_ARG;
+                    reply_to = m.src;
                     break;
                 }
 
@@ -245,13 +254,14 @@ void main(void) {
                           m.tcpip_write.data_len);
 
                 m.type = TCPIP_WRITE_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case TCPIP_READ_MSG: {
                 struct socket *sock = lookup_socket(m.src, m.tcpip_read.sock);
                 if (!sock) {
-                    ipc_reply_err(m.src, ERR_INVALID_ARG);
+                    m.type = ERR_INVALID_ARG;
+                    reply_to = m.src;
                     break;
                 }
 
@@ -260,20 +270,21 @@ void main(void) {
                     tcp_read(sock->tcp_pcb, m.tcpip_read_reply.data,
                              sizeof(m.tcpip_read_reply.data));
 
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case TCPIP_CLOSE_MSG: {
                 struct socket *sock = lookup_socket(m.src, m.tcpip_close.sock);
                 if (!sock) {
-                    ipc_reply_err(m.src, ERR_INVALID_ARG);
+                    m.type = ERR_INVALID_ARG;
+                    reply_to = m.src;
                     break;
                 }
 
                 free_socket(sock);
 
                 m.type = TCPIP_CLOSE_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             default:
@@ -377,6 +377,11 @@ void tcp_receive(ipv4addr_t dst, ipv4addr_t src, mbuf_t pkt) {
     tcp_process(pcb, src, src_ep.port, &header, pkt);
 }
 
+// 送信処理が必要なコネクションがあるかを返す。
+bool tcp_needs_flush(void) {
+    return !list_is_empty(&active_pcbs);
+}
+
 // 各PCBをチェックし、未送信データがあれば送信する。
 void tcp_flush(void) {
     LIST_FOR_EACH (pcb, &active_pcbs, struct tcp_pcb, next) {
@@ -0,0 +1 @@
+objs-y += main.o
@@ -0,0 +1,37 @@
+#include <libs/common/print.h>
+#include <libs/user/malloc.h>
+#include <libs/user/thread.h>
+
+#define NUM_THREADS 4      // 作成するスレッドの数
+#define NUM_LOOPS   10000  // 各スレッドがカウンタを増やす回数
+
+static struct spinlock lock = SPINLOCK_INIT;
+static int counter = 0;  // lockで保護されたカウンタ
+
+// 各スレッドで実行する関数。カウンタを増やし、ついでにmalloc/freeも呼び出す。
+static void worker(void *arg) {
+    int id = (int) arg;
+    for (int i = 0; i < NUM_LOOPS; i++) {
+        spin_lock(&lock);
+        counter++;
+        spin_unlock(&lock);
+
+        if (i % 1000 == 0) {
+            free(malloc(64 + id));
+        }
+    }
+}
+
+void main(void) {
+    task_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        threads[i] = thread_create(worker, (void *) i);
+        ASSERT_OK(threads[i]);
+    }
+
+    for (int i = 0; i < NUM_THREADS; i++) {
+        ASSERT_OK(thread_join(threads[i]));
+    }
+
+    INFO("counter=%d (expected %d)", counter, NUM_THREADS * NUM_LOOPS);
+}
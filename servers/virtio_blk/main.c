@@ -11,9 +11,16 @@ static struct virtio_mmio device;      // virtioデバイスの管理構造体
 static struct virtio_virtq *requestq;  // 読み書き処理要求用virtqueue
 static dmabuf_t dmabuf;                // 読み書き処理要求用virtqueueで使われるバッファ
 
-// ディスクの読み書き
-static error_t read_write(task_t task, uint64_t sector, void *buf, size_t len,
-                          bool is_write) {
+// クライアントとページ単位でデータをやり取りするためのバッファ。書き込み要求で受け取った
+// ページはここにマップされ、返信でクライアントへ返す。読み込み要求では新しく割り当てたページ
+// をここにマップし、読み込んだデータごとクライアントへ移動する。
+static __aligned(PAGE_SIZE) uint8_t page_buf[REQUEST_BUFFER_SIZE];
+
+// ディスクの読み書き。読み込みの場合は、デバイスが物理アドレスbuf_paddrのメモリへ直接
+// 書き込む。書き込みの場合はbufの内容を処理要求用のバッファにコピーする。受け取ったページの
+// 物理アドレスは分からないため、デバイスに直接読ませることはできない。
+static error_t read_write(task_t task, uint64_t sector, void *buf,
+                          paddr_t buf_paddr, size_t len, bool is_write) {
     // 読み込むバイト数はセクタサイズにアラインされている必要がある
     if (!IS_ALIGNED(len, SECTOR_SIZE)) {
         return ERR_INVALID_ARG;
@@ -46,7 +53,8 @@ static error_t read_write(task_t task, uint64_t sector, void *buf, size_t len,
     chain[0].len = sizeof(uint32_t) * 2 + sizeof(uint64_t);
     chain[0].device_writable = false;
     // ディスクリプタチェーン[1]: 書き込み元/読み込み先バッファ
-    chain[1].addr = paddr + offsetof(struct virtio_blk_req, data);
+    chain[1].addr =
+        is_write ? paddr + offsetof(struct virtio_blk_req, data) : buf_paddr;
     chain[1].len = len;
     chain[1].device_writable = !is_write;
     // ディスクリプタチェーン[2]: 処理結果用メモリ領域。デバイスが書き込む。
@@ -83,15 +91,32 @@ static error_t read_write(task_t task, uint64_t sector, void *buf, size_t len,
     ASSERT(chain[1].len == len);
     ASSERT(req->status == VIRTIO_BLK_S_OK);
 
-    // 読み込み処理の場合は読み込んだデータをメモリバッファにコピーする
-    if (!is_write) {
-        memcpy(buf, req->data, len);
-    }
-
     dmabuf_free(dmabuf, paddr);
     return OK;
 }
 
+// 読み込んだデータを入れるページを割り当ててpage_bufにマップし、その物理アドレスを返す。
+// デバイスがこのページに直接書き込み、返信でページごとクライアントへ移動するので、データの
+// コピーは起きない。
+static error_t map_read_page(paddr_t *paddr) {
+    // 返信に失敗したページが残っていればアンマップする。自身が所有していて他にマップされて
+    // いないページなので、カーネルが解放する。
+    task_t self = sys_task_self();
+    error_t err = sys_vm_unmap(self, (uaddr_t) page_buf);
+    if (err != OK && err != ERR_NOT_FOUND) {
+        return err;
+    }
+
+    pfn_t pfn_or_err = sys_pm_alloc(self, PAGE_SIZE, 0);
+    if (IS_ERROR(pfn_or_err)) {
+        return pfn_or_err;
+    }
+
+    *paddr = PFN2PADDR(pfn_or_err);
+    return sys_vm_map(self, (uaddr_t) page_buf, *paddr,
+                      PAGE_READABLE | PAGE_WRITABLE);
+}
+
 // virtio-blkデバイスを初期化する
 static void init_device(void) {
     // virtioデバイスを初期化する
@@ -123,37 +148,51 @@ void main(void) {
     ASSERT_OK(ipc_register("blk_device"));
     TRACE("ready");
 
+    struct message m;
+    task_t reply_to = 0;  // 返信先のタスク (0の場合は返信しない)
     while (true) {
-        struct message m;
-        ASSERT_OK(ipc_recv(IPC_ANY, &m));
+        // 前回のメッセージへの返信と、次のメッセージの受信を1回のシステムコールで行う
+        ASSERT_OK(ipc_reply_recv_ool(reply_to, &m, page_buf));
+        reply_to = 0;
         switch (m.type) {
             case BLK_READ_MSG: {
-                uint8_t buf[SECTOR_SIZE];
                 size_t len = m.blk_read.len;
-                error_t err =
-                    read_write(m.src, m.blk_read.sector, buf, len, false);
+                paddr_t paddr;
+                error_t err = map_read_page(&paddr);
+                if (err == OK) {
+                    err = read_write(m.src, m.blk_read.sector, page_buf, paddr,
+                                     len, false);
+                }
+
                 if (err != OK) {
-                    ipc_reply_err(m.src, err);
+                    m.type = err;
+                    reply_to = m.src;
                     break;
                 }
 
+                // 読み込んだデータをページごとクライアントへ移動する
                 m.type = BLK_READ_REPLY_MSG;
-                m.blk_read_reply.data_len = m.blk_read.len;
-                memcpy(m.blk_read_reply.data, buf, len);
-                ipc_reply(m.src, &m);
+                m.blk_read_reply.data = (uaddr_t) page_buf;
+                m.blk_read_reply.data_len = len;
+                reply_to = m.src;
                 break;
             }
             case BLK_WRITE_MSG: {
-                error_t err =
-                    read_write(m.src, m.blk_write.sector, m.blk_write.data,
-                               m.blk_write.data_len, true);
+                // 書き込むデータのページはpage_bufにマップされている
+                size_t len = m.blk_write.data_len;
+                error_t err = read_write(m.src, m.blk_write.sector, page_buf, 0,
+                                         len, true);
                 if (err != OK) {
-                    ipc_reply_err(m.src, err);
+                    m.type = err;
+                    reply_to = m.src;
                     break;
                 }
 
+                // 書き込んだページを返す
                 m.type = BLK_WRITE_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                m.blk_write_reply.data = (uaddr_t) page_buf;
+                m.blk_write_reply.data_len = len;
+                reply_to = m.src;
                 break;
             }
             default:
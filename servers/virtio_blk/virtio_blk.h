@@ -15,7 +15,8 @@
 #define SECTOR_SIZE 512
 
 // 一度に読み書きできる最大バイト数。セクタサイズにアラインされている必要がある。
-#define REQUEST_BUFFER_SIZE SECTOR_SIZE
+// 1ページ分をまとめて読み書きできるようにしている。
+#define REQUEST_BUFFER_SIZE PAGE_SIZE
 
 STATIC_ASSERT(IS_ALIGNED(REQUEST_BUFFER_SIZE, SECTOR_SIZE),
               "virtio-blk buffer size must be aligned to the sector size");
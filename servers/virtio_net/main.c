@@ -42,6 +42,8 @@ static error_t transmit(const void *payload, size_t len) {
     req->header.gso_size = 0;
     req->header.checksum_start = 0;
     req->header.checksum_offset = 0;
+    // ペイロードはオープン受信したメッセージの中にあり、物理アドレスが分からないのでDMAで
+    // 直接読ませられない。TX用のバッファにコピーする。
     memcpy((uint8_t *) &req->payload, payload, len);
 
     // ディスクリプタチェーンを作成する
@@ -82,12 +84,16 @@ static void irq_handler(void) {
             // ディスクリプタの物理アドレスから対応する仮想アドレスを得る
             struct virtio_net_req *req = dmabuf_p2v(rx_dmabuf, chain[0].addr);
 
-            // TCP/IPサーバにパケットを送信する
+            // TCP/IPサーバにパケットを送信する。パケットはメッセージにコピーせず、受信
+            // バッファから直接送信する。
             struct message m;
             m.type = NET_RECV_MSG;
-            memcpy(m.net_recv.payload, &req->payload, total_len);
             m.net_recv.payload_len = total_len;
-            OOPS_OK(ipc_send(tcpip_server, &m));
+            struct ipc_iovec iovs[2] = {
+                {.base = &m, .len = offsetof(struct message, net_recv.payload)},
+                {.base = &req->payload, .len = total_len},
+            };
+            OOPS_OK(ipc_sendv_port(tcpip_server, NET_RECV_PORT, iovs, 2));
 
             // 受信したメモリバッファを再度キューに戻す
             virtq_push(rx_virtq, chain, 1);
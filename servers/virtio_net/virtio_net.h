@@ -13,6 +13,10 @@
 #define VIRTIO_NET_QUEUE_RX    0
 #define VIRTIO_NET_QUEUE_TX    1
 
+// 受信パケットを送るTCP/IPサーバのポート。アプリケーションからの要求 (ポート0) よりも
+// 優先して処理される。
+#define NET_RECV_PORT 1
+
 // デバイス固有のコンフィグ領域 (MMIO)
 struct virtio_net_config {
     uint8_t macaddr[6];
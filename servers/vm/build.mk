@@ -1,4 +1,5 @@
 objs-y += main.o task.o bootfs.o pm.o page_fault.o bootfs_image.o
 cflags-y += -DBOOTFS_PATH='"$(bootfs_bin)"' -DBOOT_SERVERS='"$(BOOT_SERVERS)"'
+cflags-y += -DSERVER_AFFINITY='"$(SERVER_AFFINITY)"'
 
 $(build_dir)/bootfs_image.o: $(bootfs_bin)
@@ -54,17 +54,20 @@ void main(void) {
     sys_time(5000);
 
     TRACE("ready");
+    struct message m;
+    task_t reply_to = 0;  // 返信先のタスク (0の場合は返信しない)
     while (true) {
-        struct message m;
-        error_t err = ipc_recv(IPC_ANY, &m);
+        // 前回のメッセージへの返信と、次のメッセージの受信を1回のシステムコールで行う
+        error_t err = ipc_reply_recv(reply_to, &m);
         ASSERT_OK(err);
+        reply_to = 0;
 
         switch (m.type) {
             case PING_MSG: {
                 int value = m.ping.value;
                 m.type = PING_REPLY_MSG;
                 m.ping_reply.value = value;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case NOTIFY_TIMER_MSG: {
@@ -78,7 +81,7 @@ void main(void) {
                 task->watch_tasks = true;
 
                 m.type = WATCH_TASKS_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case SERVICE_LOOKUP_MSG: {
@@ -95,7 +98,7 @@ void main(void) {
 
                 m.type = SERVICE_LOOKUP_REPLY_MSG;
                 m.service_lookup_reply.task = server_task;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case SERVICE_REGISTER_MSG: {
@@ -108,7 +111,7 @@ void main(void) {
                 service_register(task, name);
 
                 m.type = SERVICE_REGISTER_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case SPAWN_TASK_MSG: {
@@ -117,25 +120,27 @@ void main(void) {
 
                 struct bootfs_file *file = bootfs_open(name);
                 if (!file) {
-                    ipc_reply_err(m.src, ERR_NOT_FOUND);
+                    m.type = ERR_NOT_FOUND;
+                    reply_to = m.src;
                     break;
                 }
 
                 task_t task_or_err = task_spawn(file);
                 if (IS_ERROR(task_or_err)) {
-                    ipc_reply_err(m.src, task_or_err);
+                    m.type = task_or_err;
+                    reply_to = m.src;
                     break;
                 }
 
                 m.type = SPAWN_TASK_REPLY_MSG;
                 m.spawn_task_reply.task = task_or_err;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case DESTROY_TASK_MSG: {
                 task_destroy_by_tid(m.destroy_task.task);
                 m.type = DESTROY_TASK_REPLY_MSG;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case VM_MAP_PHYSICAL_MSG: {
@@ -147,9 +152,9 @@ void main(void) {
                           m.vm_map_physical.map_flags, m.vm_map_physical.paddr,
                           &uaddr);
 
-                m.type = VM_MAP_PHYSICAL_MSG;
+                m.type = VM_MAP_PHYSICAL_REPLY_MSG;
                 m.vm_map_physical_reply.uaddr = uaddr;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case VM_ALLOC_PHYSICAL_MSG: {
@@ -165,7 +170,7 @@ void main(void) {
                 m.type = VM_ALLOC_PHYSICAL_REPLY_MSG;
                 m.vm_alloc_physical_reply.uaddr = uaddr;
                 m.vm_alloc_physical_reply.paddr = paddr;
-                ipc_reply(m.src, &m);
+                reply_to = m.src;
                 break;
             }
             case EXCEPTION_MSG: {
@@ -217,8 +222,9 @@ void main(void) {
                     break;
                 }
 
+                // スレッドでページフォルトが起きた場合は、そのスレッドに返信する
                 m.type = PAGE_FAULT_REPLY_MSG;
-                ipc_reply(task->tid, &m);
+                reply_to = m.page_fault.thread;
                 break;
             }
             default:
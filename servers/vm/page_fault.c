@@ -72,8 +72,10 @@ error_t handle_page_fault(struct task *task, uaddr_t uaddr, uaddr_t ip,
         // 実際に使われず、この領域の仮想アドレスが他の物理ページにマップされる。
         static __aligned(PAGE_SIZE) uint8_t tmp_page[PAGE_SIZE];
 
-        // tmp_pageを一旦アンマップする。カーネルによって起動時にマップされているため。
-        ASSERT_OK(sys_vm_unmap(sys_task_self(), (uaddr_t) tmp_page));
+        // tmp_pageを一旦アンマップする。最初の1回はカーネルによって起動時にマップされて
+        // いるため。
+        error_t err = sys_vm_unmap(sys_task_self(), (uaddr_t) tmp_page);
+        ASSERT(err == OK || err == ERR_NOT_FOUND);
 
         // tmp_pageをpaddrにマップする。これにより、tmp_pageの仮想アドレスを介して
         // paddrの内容にアクセスできるようになる。
@@ -83,6 +85,10 @@ error_t handle_page_fault(struct task *task, uaddr_t uaddr, uaddr_t ip,
         // BootFSからセグメントの内容を読み込む。
         size_t copy_len = MIN(PAGE_SIZE, phdr->p_filesz - offset);
         bootfs_read(task->file, phdr->p_offset + offset, tmp_page, copy_len);
+
+        // コピーが済んだらアンマップしておく。マップしたままだとページの参照カウントが
+        // 増えたままになり、タスクがそのページを他のタスクへ移動 (ool) できなくなる。
+        ASSERT_OK(sys_vm_unmap(sys_task_self(), (uaddr_t) tmp_page));
     }
 
     // ページの属性をセグメント情報から決定する。
@@ -91,8 +97,11 @@ error_t handle_page_fault(struct task *task, uaddr_t uaddr, uaddr_t ip,
     attrs |= (phdr->p_flags & PF_W) ? PAGE_WRITABLE : 0;
     attrs |= (phdr->p_flags & PF_X) ? PAGE_EXECUTABLE : 0;
 
-    // ページをマップする。
+    // ページをマップする。同じアドレス空間の複数のスレッドが同じページでページフォルトを
+    // 起こした場合は、先に処理したページフォルトで既にマップされている。用意したページは
+    // タスクの所有物として残り、タスクの終了時に解放される。
     ASSERT(phdr->p_filesz <= phdr->p_memsz);
-    ASSERT_OK(sys_vm_map(task->tid, uaddr, paddr, attrs));
+    error_t err = sys_vm_map(task->tid, uaddr, paddr, attrs);
+    ASSERT(err == OK || err == ERR_ALREADY_EXISTS);
     return OK;
 }
@@ -8,16 +8,86 @@
 #include <libs/user/syscall.h>
 #include <libs/user/task.h>
 
-static struct task *tasks[NUM_TASKS_MAX];      // タスク管理構造体
-static list_t services = LIST_INIT(services);  // サービス管理構造体のリスト
+static struct task *tasks[NUM_TASKS_MAX];        // タスク番号から管理構造体への表
+static list_t all_tasks = LIST_INIT(all_tasks);  // タスク管理構造体のリスト
+static list_t services = LIST_INIT(services);    // サービス管理構造体のリスト
 
-// タスクIDからタスク管理構造体を取得する。
+// サーバごとのデフォルトの優先度。ここにないタスクはTASK_PRIORITY_DEFAULTで実行される。
+// デバイスドライバは計算処理の多いタスクに邪魔されないように高めにしておく。
+static const struct {
+    const char *name;
+    int priority;
+} default_priorities[] = {
+    {"virtio_net", 4},
+    {"virtio_blk", 4},
+    {"tcpip", 8},
+    {"fs", 8},
+};
+
+// ビルド設定 (SERVER_AFFINITY) で指定されたサーバのCPUアフィニティを返す。設定は
+// "<サーバ名>=<CPU番号>,<CPU番号>,..." を空白で区切って並べたもの。指定がなければ0を返す。
+static uint32_t server_affinity(const char *name) {
+    size_t name_len = strlen(name);
+    const char *p = SERVER_AFFINITY;
+    while (*p != '\0') {
+        // サーバ名を比較する。
+        bool matched = !strncmp(p, name, name_len) && p[name_len] == '=';
+        while (*p != '\0' && *p != ' ' && *p != '=') {
+            p++;
+        }
+
+        // カンマ区切りのCPU番号のリストを読み込む。
+        uint32_t affinity = 0;
+        if (*p == '=') {
+            p++;
+            while (*p >= '0' && *p <= '9') {
+                int cpu = 0;
+                while (*p >= '0' && *p <= '9') {
+                    cpu = cpu * 10 + (*p - '0');
+                    p++;
+                }
+
+                if (cpu < 32) {
+                    affinity |= 1U << cpu;
+                }
+
+                if (*p == ',') {
+                    p++;
+                }
+            }
+        }
+
+        if (matched) {
+            return affinity;
+        }
+
+        // 次のサーバ名へ進める。スペースはスキップする。
+        while (*p != '\0' && *p != ' ') {
+            p++;
+        }
+
+        while (*p == ' ') {
+            p++;
+        }
+    }
+
+    return 0;
+}
+
+// タスクIDからタスク管理構造体を取得する。削除済みのタスクの場合はNULLを返す。
 struct task *task_find(task_t tid) {
-    if (tid <= 0 || tid > NUM_TASKS_MAX) {
+    int index = TASK_INDEX(tid);
+    if (tid <= 0 || index == 0 || index > NUM_TASKS_MAX) {
         PANIC("invalid tid %d", tid);
     }
 
-    return tasks[tid - 1];
+    // タスク番号は再利用されるので、世代番号を含めてタスクIDが一致するか確認する。
+    struct task *task = tasks[index - 1];
+    if (!task || task->tid != tid) {
+        return NULL;
+    }
+
+    return task;
 }
 
 // 指定されたELFファイルからタスクを生成する。成功するとタスクID、失敗するとエラーを返す。
@@ -61,6 +131,22 @@ task_t task_spawn(struct bootfs_file *file) {
         return tid_or_err;
     }
 
+    // サーバごとのデフォルトの優先度を設定する。
+    size_t num = sizeof(default_priorities) / sizeof(default_priorities[0]);
+    for (size_t i = 0; i < num; i++) {
+        if (!strcmp(default_priorities[i].name, file->name)) {
+            OOPS_OK(sys_task_priority(tid_or_err,
+                                      default_priorities[i].priority));
+            break;
+        }
+    }
+
+    // ビルド設定で指定されたCPUアフィニティを設定する。
+    uint32_t affinity = server_affinity(file->name);
+    if (affinity) {
+        OOPS_OK(sys_task_affinity(tid_or_err, affinity));
+    }
+
     // タスク管理構造体を初期化する。
     task->file = file;
     task->file_header = file_header;
@@ -94,20 +180,25 @@ task_t task_spawn(struct bootfs_file *file) {
     strcpy_safe(task->name, sizeof(task->name), file->name);
 
     // タスク管理構造体をタスクIDテーブルに登録する。
-    tasks[task->tid - 1] = task;
+    tasks[TASK_INDEX(task->tid) - 1] = task;
+    list_elem_init(&task->next);
+    list_push_back(&all_tasks, &task->next);
     return task->tid;
 }
 
 // タスクを終了させる。
 void task_destroy(struct task *task) {
-    for (int i = 0; i < NUM_TASKS_MAX; i++) {
+    // タスクIDテーブルからタスク管理構造体を削除する。
+    tasks[TASK_INDEX(task->tid) - 1] = NULL;
+    list_remove(&task->next);
+
+    LIST_FOR_EACH (server, &all_tasks, struct task, next) {
         // タスクの終了を監視しているタスクたちに通知する。
-        struct task *server = tasks[i];
-        if (server && server->watch_tasks) {
+        if (server->watch_tasks) {
             struct message m;
             m.type = TASK_DESTROYED_MSG;
             m.task_destroyed.task = task->tid;
-            ipc_send_async(server->tid, &m);
+            OOPS_OK(ipc_send_async(server->tid, &m));
         }
     }
 
@@ -115,22 +206,22 @@ void task_destroy(struct task *task) {
     OOPS_OK(sys_task_destroy(task->tid));
     free(task->file_header);
     free(task);
-
-    // タスクIDテーブルからタスク管理構造体を削除する。
-    tasks[task_self() - 1] = NULL;
 }
 
 // タスクIDを指定してタスクを終了させる。
 error_t task_destroy_by_tid(task_t tid) {
-    for (int i = 0; i < NUM_TASKS_MAX; i++) {
-        struct task *task = tasks[i];
-        if (task && task->tid == tid) {
-            task_destroy(task);
-            return OK;
-        }
+    int index = TASK_INDEX(tid);
+    if (tid <= 0 || index == 0 || index > NUM_TASKS_MAX) {
+        return ERR_NOT_FOUND;
+    }
+
+    struct task *task = task_find(tid);
+    if (!task) {
+        return ERR_NOT_FOUND;
     }
 
-    return ERR_NOT_FOUND;
+    task_destroy(task);
+    return OK;
 }
 
 // サービスを登録する。
@@ -144,9 +235,8 @@ void service_register(struct task *task, const char *name) {
     INFO("service \"%s\" is up", name);
 
     // このサービスを待っているタスクがいたら、そのタスクに返信して待ち状態を解除してあげる。
-    for (int i = 0; i < NUM_TASKS_MAX; i++) {
-        struct task *task = tasks[i];
-        if (task && !strcmp(task->waiting_for, name)) {
+    LIST_FOR_EACH (task, &all_tasks, struct task, next) {
+        if (!strcmp(task->waiting_for, name)) {
             struct message m;
             m.type = SERVICE_LOOKUP_REPLY_MSG;
             m.service_lookup_reply.task = service->task;
@@ -174,9 +264,8 @@ task_t service_lookup_or_wait(struct task *task, const char *name) {
 
 // 未だにサービスを待っているタスクがいたら警告を出す。
 void service_dump(void) {
-    for (int i = 0; i < NUM_TASKS_MAX; i++) {
-        struct task *task = tasks[i];
-        if (task && strlen(task->waiting_for) > 0) {
+    LIST_FOR_EACH (task, &all_tasks, struct task, next) {
+        if (strlen(task->waiting_for) > 0) {
             WARN(
                 "%s: stil waiting for a service \"%s\""
                 " (hint: add the server to BOOT_SERVERS in Makefile)",
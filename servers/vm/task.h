@@ -20,6 +20,7 @@ struct service {
 // タスク管理構造体
 struct bootfs_file;
 struct task {
+    list_elem_t next;                    // タスク管理構造体のリストの要素
     task_t tid;                          // タスクID
     task_t pager;                        // ページャタスクID
     char name[TASK_NAME_LEN];            // タスク名
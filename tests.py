@@ -17,8 +17,22 @@ HinaOSの自動テスト (pytest)
 """
 import http
 import http.server
+import os
+import re
 import threading
 
+def num_cpus():
+    m = re.search(r"-smp (\d+)", os.environ.get("QEMUFLAGS", ""))
+    return int(m.group(1)) if m else 1
+
+def test_memory_selftest(run_hinaos):
+    r = run_hinaos("echo howdy")
+    assert "pm: buddy split/coalesce OK" in r.log
+    assert "pm: page cache OK" in r.log
+    assert "pm: page lookup OK" in r.log
+    assert "pm: zeroed page pool OK" in r.log
+    assert "slab: alloc/free OK" in r.log
+
 def test_hello_world(run_hinaos):
     r = run_hinaos("echo howdy")
     assert "howdy" in r.log
@@ -50,6 +64,30 @@ def test_hinavm(run_hinaos):
     assert "hinavm_server: pc=7: 123" in r.log
     assert "reply value: 42" in r.log
 
+def test_threads(run_hinaos):
+    r = run_hinaos("start threads")
+    assert "counter=40000 (expected 40000)" in r.log
+
+def test_ping(run_hinaos):
+    r = run_hinaos("ping 7; echo pinged")
+    assert "pinged" in r.log
+
+def test_lockstat(run_hinaos):
+    r = run_hinaos("lockstat")
+    assert "locks (cycles):" in r.log
+    assert "kernel: acquired=" in r.log
+
+def test_ipc(run_hinaos):
+    r = run_hinaos("start ipc_test")
+    assert "timeout: OK" in r.log
+    assert "ports: OK" in r.log
+    assert "async: OK" in r.log
+    assert "spin: OK" in r.log
+    # 複数のCPUがあれば、他のCPUのスレッドへのipc_callで返信をスピンして待てている
+    if num_cpus() > 1:
+        m = re.search(r"IPC spin: (\d+)/", r.log)
+        assert m and int(m.group(1)) > 0
+
 def test_crack(run_hinaos):
     # crackに成功するまでタイムアウトを伸ばしていく
     for i in range(1, 5):
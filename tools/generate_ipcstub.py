@@ -188,7 +188,13 @@ def generate(args, idl):
         for field in fields:
             type_ = field["type"]
             if type_["name"] == "bytes":
+                # 長さフィールドを先に置くことで、末尾のバイト列のうち未使用の部分を
+                # コピーせずに済むようにする。
+                defs.append(f"size_t {field['name']}_len")
                 defs.append(f"uint8_t {field['name']}[{type_['nr']}]")
+            elif type_["name"] == "ool":
+                # ページ単位で転送されるバッファ: 先頭アドレスと長さ
+                defs.append(f"uaddr_t {field['name']}")
                 defs.append(f"size_t {field['name']}_len")
             elif type_["name"] == "cstr":
                 defs.append(f"char {field['name']}[{type_['nr']}]")
@@ -200,9 +206,41 @@ def generate(args, idl):
                 defs.append(def_)
         return defs
 
+    def layout(struct_name, fields):
+        # 末尾のフィールドがバイト列の場合は、その長さフィールドの値に応じてメッセージの
+        # 長さが変わる。
+        if fields and fields[-1]["type"]["name"] == "bytes":
+            name = fields[-1]["name"]
+            nr = fields[-1]["type"]["nr"]
+            var_len = (
+                f"offsetof(struct {struct_name}, {name}), "
+                + f"offsetof(struct {struct_name}, {name}_len), {nr}"
+            )
+        else:
+            var_len = f"sizeof(struct {struct_name}), 0, 0"
+
+        # ページ単位で転送されるバッファ (ool) のフィールド。1つのメッセージにつき1つまで。
+        ools = [f for f in fields if f["type"]["name"] == "ool"]
+        if len(ools) > 1:
+            raise ParseError(
+                f"{struct_name}: only one ool field is allowed in a message"
+            )
+        elif ools:
+            name = ools[0]["name"]
+            nr = ools[0]["type"]["nr"]
+            ool = (
+                f"offsetof(struct {struct_name}, {name}), "
+                + f"offsetof(struct {struct_name}, {name}_len), {nr}"
+            )
+        else:
+            ool = "0, 0, 0"
+
+        return f"{{ {var_len}, {ool} }}"
+
     renderer = jinja2.Environment()
     renderer.filters["newlines_to_whitespaces"] = lambda text: text.replace("\n", " ")
     renderer.filters["field_defs"] = field_defs
+    renderer.globals["layout"] = layout
     template = renderer.from_string(
         """\
 #pragma once
@@ -262,6 +300,16 @@ struct {{ msg.name }}_reply_fields {{ "{" }}
     {% endfor %} \\
     {{ "}" }}
 
+#define IPCSTUB_MSG_LAYOUTS \\
+    {{ "{" }} \\
+    {% for m in messages %} \\
+        [{{ m.id }}] = {{ layout(m.name + "_fields", m.args.fields) }}, \\
+        {%- if not m.oneway %}
+        [{{ m.reply_id }}] = {{ layout(m.name + "_reply_fields", m.rets.fields) }}, \\
+        {%- endif %}
+    {% endfor %} \\
+    {{ "}" }}
+
 #define IPCSTUB_STATIC_ASSERTIONS \\
 {%- for msg in messages %}
     _Static_assert( \\